@@ -1,13 +1,60 @@
+#include <inc/x86.h>
 #include <inc/string.h>
+#include <arch/thread.h>
 
 #include "fs.h"
 
 struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
 
+// Blocks the server may have modified since the last fs_sync().
+// dirtybits has one bit per disk block and keeps dirtylist free of
+// duplicates; fs_sync() only visits the blocks on dirtylist.
+#define NDIRTY		(BLKSIZE / 4)
+
+// Maximum number of blocks file_get_block reads ahead in one disk
+// command (ide_read handles at most 256 sectors).
+#define RA_BLOCKS	(256 / BLKSECTS)
+static uint32_t dirtybits[DISKSIZE / BLKSIZE / 32];
+static uint32_t dirtylist[NDIRTY];
+static int ndirty;
+
+// Number of free blocks described by each bitmap block,
+// so the allocator can skip full regions of the disk.
+static uint32_t bitmap_nfree[DISKSIZE / BLKSIZE / BLKBITSIZE];
+// Where the next allocation without a placement hint starts looking.
+static uint32_t alloc_cursor;
+
+// Request threads yield while the disk is busy.  disk_lock keeps one
+// disk command, and the block-cache update around it, in flight at a
+// time; sync_lock keeps one fs_sync() walking the dirty list.
+static volatile uint32_t disk_lock;
+static volatile uint32_t sync_lock;
+
+// Blocks being read are loaded here and only then mapped at their
+// disk addresses, so no other thread sees a half-read block.
+#define STAGEVA		(DISKMAP + DISKSIZE + PTSIZE)
+
 void file_flush(struct File *f);
 bool block_is_free(uint32_t blockno);
 
+// Cooperative-thread locks.  Threads only switch when one yields,
+// so testing and setting the lock word cannot be interrupted.
+void
+lock_acquire(volatile uint32_t *lock)
+{
+	while (*lock)
+		thread_wait(lock, 1, (uint32_t) ~0);
+	*lock = 1;
+}
+
+void
+lock_release(volatile uint32_t *lock)
+{
+	*lock = 0;
+	thread_wakeup(lock);
+}
+
 // Return the virtual address of this disk block.
 char*
 diskaddr(uint32_t blockno)
@@ -56,6 +103,41 @@ map_block(uint32_t blockno)
 	return sys_page_alloc(0, diskaddr(blockno), PTE_U|PTE_P|PTE_W);
 }
 
+// Read the 'n' consecutive disk blocks starting at 'blockno' into memory
+// with a single multi-sector disk command, stopping short at the first
+// block that is already mapped (another thread may have loaded it while
+// we waited for the disk).  At most RA_BLOCKS blocks.
+// Returns 0 on success, or a negative error code on error.
+static int
+read_blocks(uint32_t blockno, uint32_t n)
+{
+	int r;
+	uint32_t i;
+	char *stage = (char*) STAGEVA;
+
+	assert(n <= RA_BLOCKS);
+	lock_acquire(&disk_lock);
+	for (i = 0; i < n && !block_is_mapped(blockno + i); i++)
+		if ((r = sys_page_alloc(0, stage + i*BLKSIZE, PTE_U|PTE_P|PTE_W)))
+			goto out;
+	n = i;
+
+	if (n > 0 && (r = ide_read(BLKSECTS*blockno, stage, n*BLKSECTS)))
+		goto out;
+
+	// Mapping the pages afresh also leaves PTE_D clear: they are clean.
+	for (i = 0; i < n; i++)
+		if ((r = sys_page_map(0, stage + i*BLKSIZE, 0, diskaddr(blockno + i),
+				      PTE_U|PTE_P|PTE_W)))
+			goto out;
+	r = 0;
+out:
+	for (i = 0; i < n; i++)
+		sys_page_unmap(0, stage + i*BLKSIZE);
+	lock_release(&disk_lock);
+	return r;
+}
+
 // Make sure a particular disk block is loaded into memory.
 // Returns 0 on success, or a negative error code on error.
 // 
@@ -74,13 +156,9 @@ read_block(uint32_t blockno, char **blk)
 
         addr = diskaddr(blockno);
 
-	if (!block_is_mapped(blockno)) {
-          if ((r = map_block(blockno)))
-            return r;
-
-          if ((r = ide_read(BLKSECTS*blockno, addr, BLKSECTS)))
+	if (!block_is_mapped(blockno))
+          if ((r = read_blocks(blockno, 1)))
             return r;
-        }
 
         if (blk)
           *blk = addr;
@@ -88,7 +166,9 @@ read_block(uint32_t blockno, char **blk)
 }
 
 // Copy the current contents of the block out to disk.
-// Then clear the PTE_D bit using sys_page_map.
+// The PTE_D bit is cleared (using sys_page_map) before the write starts,
+// so a change another thread makes while we wait for the disk keeps
+// the block dirty.
 void
 write_block(uint32_t blockno)
 {
@@ -97,15 +177,46 @@ write_block(uint32_t blockno)
 	if (!block_is_mapped(blockno))
 		panic("write unmapped block %08x", blockno);
 	
-	// Write the disk block and clear PTE_D.
+	// Clear PTE_D and write the disk block.
         addr = diskaddr(blockno);
         int r;
-        if ((r = ide_write(BLKSECTS*blockno, addr, BLKSECTS)))
-          panic("ide_write: %e", r);
-
+        lock_acquire(&disk_lock);
         int perm = vpt[VPN(addr)] & PTE_USER;
         if ((r = sys_page_map(0, addr, 0, addr, perm)))
           panic("sys_page_map: %e", r);
+
+        if ((r = ide_write(BLKSECTS*blockno, addr, BLKSECTS)))
+          panic("ide_write: %e", r);
+        lock_release(&disk_lock);
+}
+
+// Record that block 'blockno' may have been modified in memory,
+// so that the next fs_sync() will look at it.
+// If the dirty list is full, sync first to make room.
+void
+block_mark_dirty(uint32_t blockno)
+{
+	if (dirtybits[blockno / 32] & (1 << (blockno % 32)))
+		return;
+	while (ndirty == NDIRTY)
+		fs_sync();
+	dirtybits[blockno / 32] |= 1 << (blockno % 32);
+	dirtylist[ndirty++] = blockno;
+}
+
+// Return the number of the disk block mapped at 'va'.
+static uint32_t
+va2blockno(void *va)
+{
+	return ((uintptr_t) va - DISKMAP) / BLKSIZE;
+}
+
+// Record that the block holding file descriptor 'f' may have been modified.
+// 'f' always lives in a mapped directory block (or the superblock).
+void
+file_mark_dirty(struct File *f)
+{
+	block_mark_dirty(va2blockno(f));
 }
 
 // Make sure this block is unmapped.
@@ -137,50 +248,122 @@ block_is_free(uint32_t blockno)
 }
 
 // Mark a block free in the bitmap
-// WEI: when to write bitmap back?
+// The bitmap block is written back by the next fs_sync().
 void
 free_block(uint32_t blockno)
 {
 	// Blockno zero is the null pointer of block numbers.
 	if (blockno == 0)
 		panic("attempt to free zero block");
+	if (!block_is_free(blockno))
+		bitmap_nfree[blockno / BLKBITSIZE]++;
 	bitmap[blockno/32] |= 1<<(blockno%32);
+	block_mark_dirty(2 + blockno/BLKBITSIZE);
+}
+
+// Return the first free block in [lo, hi), or -E_NO_DISK if there is none.
+// Scans a word at a time and skips bitmap blocks with no free bits.
+static int
+bitmap_find_free(uint32_t lo, uint32_t hi)
+{
+	uint32_t bb, w, word;
+
+	while (lo < hi) {
+		bb = lo / BLKBITSIZE;
+		if (bitmap_nfree[bb] == 0) {
+			lo = (bb + 1) * BLKBITSIZE;
+			continue;
+		}
+		w = lo / 32;
+		word = bitmap[w] & (~0U << (lo % 32));
+		if (word) {
+			lo = w * 32 + bsf(word);
+			return lo < hi ? (int) lo : -E_NO_DISK;
+		}
+		lo = (w + 1) * 32;
+	}
+	return -E_NO_DISK;
 }
 
 // Search the bitmap for a free block and allocate it.  When you
 // allocate a block, immediately flush the changed bitmap block
 // to disk.
+// The search starts at block 'hint' (if it is a valid block number,
+// otherwise at the allocation cursor) and wraps around the disk,
+// so that consecutive allocations come out contiguous.
 // 
 // Return block number allocated on success,
 // -E_NO_DISK if we are out of blocks.
 int
-alloc_block_num(void)
+alloc_block_num(uint32_t hint)
 {
-  int i = 2 + super->s_nblocks/BLKBITSIZE;
-  for (; i < super->s_nblocks; i++)
-    if (block_is_free(i)) {
-      bitmap[i/32] &= ~(1<<(i%32));
-      write_block(i/BLKBITSIZE + 2);
-      return i;
-    }
-  
-  return -E_NO_DISK;
+	int bno;
+
+	if (hint == 0 || hint >= super->s_nblocks)
+		hint = alloc_cursor;
+	if ((bno = bitmap_find_free(hint, super->s_nblocks)) < 0
+	    && (bno = bitmap_find_free(0, hint)) < 0)
+		return bno;
+
+	bitmap[bno/32] &= ~(1<<(bno%32));
+	bitmap_nfree[bno / BLKBITSIZE]--;
+	write_block(bno/BLKBITSIZE + 2);
+	alloc_cursor = bno + 1;
+	return bno;
 }
 
-// Allocate a block -- first find a free block in the bitmap,
+// Allocate a block, preferably at 'hint' or just after it --
+// first find a free block in the bitmap,
 // then map it into memory using map_block.
 int
+alloc_block_near(uint32_t hint)
+{
+	int bno = alloc_block_num(hint);
+	if (bno < 0)
+		return bno;
+	int r = map_block(bno);
+	if (r) {
+		free_block(bno);
+		return r;
+	}
+	return bno;
+}
+
+// Find a run of 'n' free blocks, searching from 'hint' and wrapping around.
+// Returns the first block of the first run that is long enough, or of the
+// longest run seen if none is, or -E_NO_DISK if there are no free blocks.
+static int
+bitmap_find_run(uint32_t hint, uint32_t n)
+{
+	int bno, best = -E_NO_DISK;
+	uint32_t lo, hi, len, bestlen = 0;
+	int pass;
+
+	if (hint == 0 || hint >= super->s_nblocks)
+		hint = alloc_cursor;
+	for (pass = 0; pass < 2; pass++) {
+		lo = pass ? 0 : hint;
+		hi = pass ? hint : super->s_nblocks;
+		while ((bno = bitmap_find_free(lo, hi)) >= 0) {
+			for (len = 1; len < n && block_is_free(bno + len); len++)
+				/* do nothing */;
+			if (len > bestlen) {
+				best = bno;
+				bestlen = len;
+				if (len == n)
+					return best;
+			}
+			lo = bno + len;
+		}
+	}
+	return best;
+}
+
+// Allocate a block wherever the allocation cursor points.
+int
 alloc_block(void)
 {
-  int bno = alloc_block_num();
-  if (bno < 0)
-    return bno;
-  int r = map_block(bno);
-  if (r) {
-    free_block(bno);
-    return r;
-  }
-  return bno;
+	return alloc_block_near(0);
 }
 
 // Read and validate the file system super-block.
@@ -216,7 +399,7 @@ void
 read_bitmap(void)
 {
 	int r;
-	uint32_t i;
+	uint32_t i, j, word;
 	char *blk;
 
 	// Read the bitmap into memory.
@@ -231,7 +414,14 @@ read_bitmap(void)
 			bitmap = (uint32_t*) blk;
 		// Make sure all bitmap blocks are marked in-use
 		assert(!block_is_free(2+i));
+
+		// Count the free blocks this bitmap block describes.
+		bitmap_nfree[i] = 0;
+		for (j = 0; j < BLKSIZE / 4; j++)
+			for (word = ((uint32_t*) blk)[j]; word; word &= word - 1)
+				bitmap_nfree[i]++;
 	}
+	alloc_cursor = 2 + i;
 
 	// Make sure the reserved and root blocks are marked in-use.
 	assert(!block_is_free(0));
@@ -290,11 +480,40 @@ fs_init(void)
 	read_bitmap();
 }
 
+// Set '*pblk' to the in-memory contents of the block-pointer block whose
+// number is stored in '*pbno'.  If '*pbno' is 0 and 'alloc' is set,
+// allocate a cleared block (near 'hint') and store its number in '*pbno'.
+static int
+pointer_block(uint32_t *pbno, uint32_t hint, bool alloc, uint32_t **pblk)
+{
+	int r;
+	char *va;
+
+	if (*pbno == 0) {
+		if (!alloc)
+			return -E_NOT_FOUND;
+		if ((r = alloc_block_near(hint)) < 0)
+			return r;
+		*pbno = r;
+		block_mark_dirty(va2blockno(pbno));
+		va = diskaddr(r);
+		// Hint: Don't forget to clear any block you allocate.
+		memset(va, 0, BLKSIZE);
+		write_block(r);
+	} else if ((r = read_block(*pbno, &va)) < 0)
+		return r;
+
+	*pblk = (uint32_t *) va;
+	return 0;
+}
+
 // Find the disk block number slot for the 'filebno'th block in file 'f'.
 // Set '*ppdiskbno' to point to that slot.
 // The slot will be one of the f->f_direct[] entries,
-// or an entry in the indirect block.
-// When 'alloc' is set, this function will allocate an indirect block
+// an entry in the indirect block, or, for filebno >= NINDIRECT,
+// an entry in one of the indirect blocks hanging off the
+// double-indirect block.
+// When 'alloc' is set, this function will allocate indirect blocks
 // if necessary.
 //
 // Returns:
@@ -303,41 +522,62 @@ fs_init(void)
 //		alloc was 0.
 //	-E_NO_DISK if there's no space on the disk for an indirect block.
 //	-E_NO_MEM if there's no space in memory for an indirect block.
-//	-E_INVAL if filebno is out of range (it's >= NINDIRECT).
+//	-E_INVAL if filebno is out of range (it's >= NINDIRECT + NDINDIRECT).
 int
 file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool alloc)
 {
-  if (filebno >= NINDIRECT)
-    return -E_INVAL;
-  if (filebno < NDIRECT) {
-    if (ppdiskbno)
-      *ppdiskbno = &f->f_direct[filebno];
-    return 0;
-  }
+	int r, i;
+	uint32_t *ind, *dind, hint;
+
+	if (filebno >= NINDIRECT + NDINDIRECT)
+		return -E_INVAL;
+	if (filebno < NDIRECT) {
+		if (ppdiskbno)
+			*ppdiskbno = &f->f_direct[filebno];
+		return 0;
+	}
 
-  char *va;
-  if (!f->f_indirect) {
-    if (!alloc)
-      return -E_NOT_FOUND;
-    int ind = alloc_block();
-    if (ind < 0)
-      return ind;
-    f->f_indirect = ind;
-    map_block(ind);
-    va = diskaddr(ind);
-// Hint: Don't forget to clear any block you allocate.
-    memset(va, 0, BLKSIZE);
-    write_block(ind);
-  }
-  else {
-    int r = read_block(f->f_indirect, &va);
-    if (r)
-      return r;
-  }
+	if (filebno < NINDIRECT) {
+		// Put the indirect block after the file's last direct
+		// block, if it has one.
+		for (i = NDIRECT - 1; i >= 0 && !f->f_direct[i]; i--)
+			;
+		hint = i >= 0 ? f->f_direct[i] + 1 : 0;
+		if ((r = pointer_block(&f->f_indirect, hint, alloc, &ind)) < 0)
+			return r;
+	} else {
+		filebno -= NINDIRECT;
+		if ((r = pointer_block(&f->f_dindirect, 0, alloc, &dind)) < 0
+		    || (r = pointer_block(&dind[filebno / NINDIRECT], 0,
+				alloc, &ind)) < 0)
+			return r;
+		filebno %= NINDIRECT;
+	}
 
-  if (ppdiskbno)
-    *ppdiskbno = (uint32_t *)va + filebno;
-  return 0;
+	if (ppdiskbno)
+		*ppdiskbno = ind + filebno;
+	return 0;
+}
+
+// Allocate a disk block for the 'filebno'th block in file 'f' and store
+// it in '*p', the slot file_block_walk found for it.
+// The block goes at 'hint' if that is free, otherwise as close after
+// the file's previous block as possible.
+// Returns 0 on success, < 0 on error.
+static int
+file_alloc_block(struct File *f, uint32_t filebno, uint32_t *p, uint32_t hint)
+{
+	int bno;
+	uint32_t *prev;
+
+	if (!hint && filebno > 0
+	    && file_block_walk(f, filebno - 1, &prev, 0) == 0 && *prev)
+		hint = *prev + 1;
+	if ((bno = alloc_block_near(hint)) < 0)
+		return bno;
+	*p = bno;
+	block_mark_dirty(va2blockno(p));
+	return 0;
 }
 
 // Set '*diskbno' to the disk block number for the 'filebno'th block
@@ -359,10 +599,8 @@ file_map_block(struct File *f, uint32_t filebno, uint32_t *diskbno, bool alloc)
   if (!*p) {
     if (!alloc)
       return -E_NOT_FOUND;
-    int bno = alloc_block();
-    if (bno < 0)
-      return bno;
-    *p = bno;
+    if ((r = file_alloc_block(f, filebno, p, 0)) < 0)
+      return r;
   }
   *diskbno = *p;
   return 0;
@@ -376,11 +614,14 @@ file_clear_block(struct File *f, uint32_t filebno)
 	int r;
 	uint32_t *ptr;
 
-	if ((r = file_block_walk(f, filebno, &ptr, 0)) < 0)
+	if ((r = file_block_walk(f, filebno, &ptr, 0)) == -E_NOT_FOUND)
+		return 0;
+	if (r < 0)
 		return r;
 	if (*ptr) {
 		free_block(*ptr);
 		*ptr = 0;
+		block_mark_dirty(va2blockno(ptr));
 	}
 	return 0;
 }
@@ -398,6 +639,19 @@ file_get_block(struct File *f, uint32_t filebno, char **blk)
   r = file_map_block(f, filebno, &diskbno, 1);
   if (r)
     return r;
+
+  // If the following file blocks are contiguous on disk and not yet
+  // in memory, read them in with the same disk command.
+  if (!block_is_mapped(diskbno)) {
+    uint32_t n, next;
+    uint32_t nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
+    for (n = 1; n < RA_BLOCKS && filebno + n < nblocks; n++)
+      if (file_map_block(f, filebno + n, &next, 0) < 0
+          || next != diskbno + n || block_is_mapped(next))
+        break;
+    if (n > 1 && (r = read_blocks(diskbno, n)))
+      return r;
+  }
   return read_block(diskbno, blk);
 }
 
@@ -413,9 +667,244 @@ file_dirty(struct File *f, off_t offset)
   if (r)
     return r;
   *(volatile char*)blk = *blk;
+  block_mark_dirty(va2blockno(blk));
   return 0;
 }
 
+// In-memory index of directory entries, so that dir_lookup and
+// dir_alloc_file need not scan every slot of a large directory.
+// A directory is indexed the first time it is searched: its entries
+// are hashed on (directory, name) and its free slots kept on a list.
+// file_create and file_remove keep the index up to date.  Indexes are
+// evicted round-robin when the entry pool runs out; a directory with
+// more slots than the whole pool is always scanned.
+#define NDIRIDX		16		// directories indexed at once
+#define NDIRENT		8192		// entries, over all indexed directories
+#define DIRHASH		1024		// hash chains (power of 2)
+
+struct DirEnt {
+	struct File *de_file;		// the slot, inside a directory block
+	struct DirEnt *de_next;		// next on hash chain or free list
+};
+
+struct DirIndex {
+	struct File *di_dir;		// indexed directory, or 0 if unused
+	struct DirEnt *di_free;		// its free slots
+	char di_building;		// dir_index_build is still reading it
+	char di_stale;			// changed or dropped while building
+};
+
+static struct DirEnt dirents[NDIRENT];
+static struct DirEnt *dirent_free;	// released pool entries
+static uint32_t dirent_used;		// pool entries ever handed out
+static uint32_t dirent_navail = NDIRENT;
+static struct DirEnt *dirhash[DIRHASH];
+static struct DirIndex diridx[NDIRIDX];
+static int diridx_victim;
+
+static uint32_t
+dir_hash(struct File *dir, const char *name)
+{
+	uint32_t h = (uint32_t) dir;
+
+	while (*name)
+		h = h * 31 + *name++;
+	return (h ^ (h >> 10)) & (DIRHASH - 1);
+}
+
+static struct DirEnt*
+dirent_alloc(struct File *f)
+{
+	struct DirEnt *de;
+
+	if ((de = dirent_free))
+		dirent_free = de->de_next;
+	else if (dirent_used < NDIRENT)
+		de = &dirents[dirent_used++];
+	else
+		return 0;
+	dirent_navail--;
+	de->de_file = f;
+	return de;
+}
+
+static void
+dirent_release(struct DirEnt *de)
+{
+	de->de_next = dirent_free;
+	dirent_free = de;
+	dirent_navail++;
+}
+
+static struct DirIndex*
+dir_index_find(struct File *dir)
+{
+	int i;
+
+	for (i = 0; i < NDIRIDX; i++)
+		if (diridx[i].di_dir == dir)
+			return &diridx[i];
+	return 0;
+}
+
+// Forget the index of 'dir', if it has one.
+static void
+dir_index_drop(struct File *dir)
+{
+	int i;
+	struct DirIndex *di;
+	struct DirEnt *de, **pp;
+
+	if (dir == 0 || (di = dir_index_find(dir)) == 0)
+		return;
+	// The thread building it still uses it; it drops it when done.
+	if (di->di_building) {
+		di->di_stale = 1;
+		return;
+	}
+	for (i = 0; i < DIRHASH; i++)
+		for (pp = &dirhash[i]; (de = *pp) != 0; )
+			if (de->de_file->f_dir == dir) {
+				*pp = de->de_next;
+				dirent_release(de);
+			} else
+				pp = &de->de_next;
+	while ((de = di->di_free) != 0) {
+		di->di_free = de->de_next;
+		dirent_release(de);
+	}
+	di->di_dir = 0;
+}
+
+// Build the index of 'dir', evicting other indexes to make room.
+// Reading the directory may yield to other threads, so until it is
+// done the index is marked building: lookups scan the directory
+// instead, and changes to the directory make the index stale, to be
+// dropped at the end.
+// Returns 0 if the directory cannot be indexed.
+static struct DirIndex*
+dir_index_build(struct File *dir)
+{
+	uint32_t i, j, h, nblock;
+	int k;
+	char *blk;
+	struct File *f;
+	struct DirEnt *de;
+	struct DirIndex *di;
+
+	nblock = dir->f_size / BLKSIZE;
+	if (nblock * BLKFILES > NDIRENT)
+		return 0;
+	if ((di = dir_index_find(0)) == 0) {
+		for (k = 0; k < NDIRIDX && diridx[diridx_victim].di_building; k++)
+			diridx_victim = (diridx_victim + 1) % NDIRIDX;
+		if (k == NDIRIDX)
+			return 0;
+		di = &diridx[diridx_victim];
+		dir_index_drop(di->di_dir);
+		diridx_victim = (diridx_victim + 1) % NDIRIDX;
+	}
+	// Indexes being built give up their entries only when done.
+	for (k = 0; dirent_navail < nblock * BLKFILES; k++) {
+		if (k == 2 * NDIRIDX)
+			return 0;
+		if (&diridx[diridx_victim] != di)
+			dir_index_drop(diridx[diridx_victim].di_dir);
+		diridx_victim = (diridx_victim + 1) % NDIRIDX;
+	}
+	di->di_dir = dir;
+	di->di_free = 0;
+	di->di_building = 1;
+	di->di_stale = 0;
+
+	// Walk backwards so the lowest free slot ends up first on the list.
+	for (i = nblock; i-- > 0; ) {
+		if (file_get_block(dir, i, &blk) < 0)
+			goto fail;
+		f = (struct File*) blk;
+		for (j = BLKFILES; j-- > 0; ) {
+			f[j].f_dir = dir;
+			if ((de = dirent_alloc(&f[j])) == 0)
+				goto fail;
+			if (f[j].f_name[0] == '\0') {
+				de->de_next = di->di_free;
+				di->di_free = de;
+			} else {
+				h = dir_hash(dir, f[j].f_name);
+				de->de_next = dirhash[h];
+				dirhash[h] = de;
+			}
+		}
+	}
+	di->di_building = 0;
+	if (di->di_stale)
+		goto fail;
+	return di;
+
+fail:
+	di->di_building = 0;
+	dir_index_drop(dir);
+	return 0;
+}
+
+// Return the index of 'dir', building it if need be, or 0 if the
+// directory has no usable index and must be scanned.
+static struct DirIndex*
+dir_index_get(struct File *dir)
+{
+	struct DirIndex *di;
+
+	if ((di = dir_index_find(dir)) != 0)
+		return di->di_building ? 0 : di;
+	return dir_index_build(dir);
+}
+
+// Record that slot 'f' of an indexed directory now holds a file.
+static void
+dir_index_add(struct File *f)
+{
+	uint32_t h;
+	struct DirEnt *de;
+	struct DirIndex *di;
+
+	if ((di = dir_index_find(f->f_dir)) == 0)
+		return;
+	if (di->di_building) {
+		di->di_stale = 1;
+		return;
+	}
+	if ((de = dirent_alloc(f)) == 0) {
+		dir_index_drop(f->f_dir);
+		return;
+	}
+	h = dir_hash(f->f_dir, f->f_name);
+	de->de_next = dirhash[h];
+	dirhash[h] = de;
+}
+
+// Record that slot 'f' of an indexed directory is about to be freed.
+static void
+dir_index_remove(struct File *f)
+{
+	struct DirIndex *di;
+	struct DirEnt *de, **pp;
+
+	if ((di = dir_index_find(f->f_dir)) == 0)
+		return;
+	if (di->di_building) {
+		di->di_stale = 1;
+		return;
+	}
+	for (pp = &dirhash[dir_hash(f->f_dir, f->f_name)]; (de = *pp) != 0;
+	     pp = &de->de_next)
+		if (de->de_file == f) {
+			*pp = de->de_next;
+			de->de_next = di->di_free;
+			di->di_free = de;
+			return;
+		}
+}
+
 // Try to find a file named "name" in dir.  If so, set *file to it.
 int
 dir_lookup(struct File *dir, const char *name, struct File **file)
@@ -424,11 +913,22 @@ dir_lookup(struct File *dir, const char *name, struct File **file)
 	uint32_t i, j, nblock;
 	char *blk;
 	struct File *f;
+	struct DirEnt *de;
 
 	// Search dir for name.
 	// We maintain the invariant that the size of a directory-file
 	// is always a multiple of the file system's block size.
 	assert((dir->f_size % BLKSIZE) == 0);
+	if (dir_index_get(dir)) {
+		for (de = dirhash[dir_hash(dir, name)]; de; de = de->de_next)
+			if (de->de_file->f_dir == dir
+			    && strcmp(de->de_file->f_name, name) == 0) {
+				*file = de->de_file;
+				return 0;
+			}
+		return -E_NOT_FOUND;
+	}
+
 	nblock = dir->f_size / BLKSIZE;
 	for (i = 0; i < nblock; i++) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
@@ -452,29 +952,112 @@ dir_alloc_file(struct File *dir, struct File **file)
 	uint32_t nblock, i, j;
 	char *blk;
 	struct File *f;
+	struct DirEnt *de;
+	struct DirIndex *di;
 
 	assert((dir->f_size % BLKSIZE) == 0);
 	nblock = dir->f_size / BLKSIZE;
-	for (i = 0; i < nblock; i++) {
-		if ((r = file_get_block(dir, i, &blk)) < 0)
-			return r;
-		f = (struct File*) blk;
-		for (j = 0; j < BLKFILES; j++)
-			if (f[j].f_name[0] == '\0') {
-				*file = &f[j];
-				f[j].f_dir = dir;
-				return 0;
-			}
+	if ((di = dir_index_get(dir)) != 0) {
+		if ((de = di->di_free) != 0) {
+			di->di_free = de->de_next;
+			*file = de->de_file;
+			dirent_release(de);
+			return 0;
+		}
+		i = nblock;
+	} else {
+		for (i = 0; i < nblock; i++) {
+			if ((r = file_get_block(dir, i, &blk)) < 0)
+				return r;
+			f = (struct File*) blk;
+			for (j = 0; j < BLKFILES; j++)
+				if (f[j].f_name[0] == '\0') {
+					*file = &f[j];
+					f[j].f_dir = dir;
+					return 0;
+				}
+		}
 	}
 	dir->f_size += BLKSIZE;
+	file_mark_dirty(dir);
 	if ((r = file_get_block(dir, i, &blk)) < 0)
 		return r;
+	// Reading the block may have let another thread evict the index.
+	if (di && (dir_index_find(dir) != di || di->di_building))
+		di = 0;
 	f = (struct File*) blk;
 	*file = &f[0];
 	f[0].f_dir = dir;
+
+	// The rest of the new block goes on the free list.
+	for (j = BLKFILES - 1; di && j > 0; j--) {
+		f[j].f_dir = dir;
+		if ((de = dirent_alloc(&f[j])) == 0) {
+			dir_index_drop(dir);
+			break;
+		}
+		de->de_next = di->di_free;
+		di->di_free = de;
+	}
+	return 0;
+}
+
+// Cache of path-name lookups, keyed on (directory, name).  A hit
+// answers a walk_path component without touching the directory,
+// including names known not to exist (d_file == 0).  The cache is
+// direct-mapped; file_create and file_remove overwrite the entry for
+// the name they change, and removing a directory flushes everything.
+#define NDCACHE		512		// entries (power of 2)
+
+struct Dentry {
+	struct File *d_dir;		// directory searched, or 0 if unused
+	struct File *d_file;		// result, or 0 if not found
+	char d_name[MAXNAMELEN];
+};
+
+static struct Dentry dcache[NDCACHE];
+
+static struct Dentry*
+dcache_slot(struct File *dir, const char *name)
+{
+	return &dcache[dir_hash(dir, name) & (NDCACHE - 1)];
+}
+
+// Return the cache entry for 'name' in 'dir', or 0 on a miss.
+static struct Dentry*
+dcache_lookup(struct File *dir, const char *name)
+{
+	struct Dentry *d = dcache_slot(dir, name);
+
+	if (d->d_dir == dir && strcmp(d->d_name, name) == 0)
+		return d;
 	return 0;
 }
 
+// Remember that 'name' in 'dir' is 'f' (0 if it does not exist).
+static void
+dcache_enter(struct File *dir, const char *name, struct File *f)
+{
+	struct Dentry *d = dcache_slot(dir, name);
+
+	d->d_dir = dir;
+	d->d_file = f;
+	strcpy(d->d_name, name);
+}
+
+// Forget every directory index and cached name.  Used when a directory
+// loses blocks: the File structures of everything below it go away,
+// and their addresses may later be reused for unrelated directories.
+static void
+dir_cache_flush(void)
+{
+	int i;
+
+	for (i = 0; i < NDIRIDX; i++)
+		dir_index_drop(diridx[i].di_dir);
+	memset(dcache, 0, sizeof(dcache));
+}
+
 // Skip over slashes.
 static inline const char*
 skip_slash(const char *p)
@@ -496,6 +1079,7 @@ walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem
 	const char *p;
 	char name[MAXNAMELEN];
 	struct File *dir, *f;
+	struct Dentry *d;
 	int r;
 
 	// if (*path != '/')
@@ -522,7 +1106,13 @@ walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem
 		if (dir->f_type != FTYPE_DIR)
 			return -E_NOT_FOUND;
 
-		if ((r = dir_lookup(dir, name, &f)) < 0) {
+		if ((d = dcache_lookup(dir, name)) != 0)
+			r = (f = d->d_file) ? 0 : -E_NOT_FOUND;
+		else if ((r = dir_lookup(dir, name, &f)) == 0)
+			dcache_enter(dir, name, f);
+		else if (r == -E_NOT_FOUND)
+			dcache_enter(dir, name, 0);
+		if (r < 0) {
 			if (r == -E_NOT_FOUND && *path == '\0') {
 				if (pdir)
 					*pdir = dir;
@@ -556,6 +1146,9 @@ file_create(const char *path, struct File **pf)
 	if (dir_alloc_file(dir, &f) < 0)
 		return r;
 	strcpy(f->f_name, name);
+	dir_index_add(f);
+	dcache_enter(dir, name, f);
+	file_mark_dirty(f);
 	*pf = f;
 	return 0;
 }
@@ -575,6 +1168,9 @@ file_open(const char *path, struct File **pf)
 // and then clear the blocks from new_nblocks to old_nblocks.
 // If the new_nblocks is no more than NDIRECT, and the indirect block has
 // been allocated (f->f_indirect != 0), then free the indirect block too.
+// Likewise free the indirect blocks under the double-indirect block
+// that no longer map any file block, and the double-indirect block itself
+// once new_nblocks is no more than NINDIRECT.
 // (Remember to clear the f->f_indirect pointer so you'll know
 // whether it's valid!)
 // Do not change f->f_size.
@@ -582,7 +1178,7 @@ static void
 file_truncate_blocks(struct File *f, off_t newsize)
 {
 	int r;
-	uint32_t bno, old_nblocks, new_nblocks;
+	uint32_t bno, i, old_nblocks, new_nblocks, *dind;
 
 	// Hint: Use file_clear_block and/or free_block.
 	old_nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
@@ -594,15 +1190,87 @@ file_truncate_blocks(struct File *f, off_t newsize)
 	if (new_nblocks <= NDIRECT && f->f_indirect) {
 		free_block(f->f_indirect);
 		f->f_indirect = 0;
+		file_mark_dirty(f);
+	}
+
+	if (f->f_dindirect
+	    && pointer_block(&f->f_dindirect, 0, 0, &dind) == 0) {
+		for (i = 0; i < NINDIRECT; i++)
+			if (dind[i] && NINDIRECT + i * NINDIRECT >= new_nblocks) {
+				free_block(dind[i]);
+				dind[i] = 0;
+				block_mark_dirty(f->f_dindirect);
+			}
+		if (new_nblocks <= NINDIRECT) {
+			free_block(f->f_dindirect);
+			f->f_dindirect = 0;
+			file_mark_dirty(f);
+		}
 	}
 }
 
+// Reserve disk blocks for file 'f' up to 'newsize' bytes and extend
+// the file to that size.  Unlike file_set_size, which leaves blocks to
+// be allocated one at a time on first access, this allocates them all
+// now, as a single contiguous run if the disk has one.
+// Returns 0 on success, < 0 on error.
+int
+file_allocate(struct File *f, off_t newsize)
+{
+	int r, run;
+	uint32_t bno, hint, old_nblocks, new_nblocks, *ptr;
+
+	if (newsize > MAXFILESIZE)
+		return -E_INVAL;
+	if (newsize <= f->f_size)
+		return 0;
+
+	old_nblocks = (f->f_size + BLKSIZE - 1) / BLKSIZE;
+	new_nblocks = (newsize + BLKSIZE - 1) / BLKSIZE;
+
+	// Allocate the indirect blocks first so they don't split the run.
+	for (bno = old_nblocks; bno < new_nblocks; bno++)
+		if ((bno == old_nblocks || bno == NDIRECT
+		     || (bno >= NINDIRECT && (bno - NINDIRECT) % NINDIRECT == 0))
+		    && (r = file_block_walk(f, bno, 0, 1)) < 0)
+			goto fail;
+
+	hint = 0;
+	if (old_nblocks > 0
+	    && file_block_walk(f, old_nblocks - 1, &ptr, 0) == 0 && *ptr)
+		hint = *ptr + 1;
+	bno = old_nblocks;
+	if ((r = run = bitmap_find_run(hint, new_nblocks - old_nblocks)) < 0)
+		goto fail;
+
+	for (bno = old_nblocks; bno < new_nblocks; bno++) {
+		if ((r = file_block_walk(f, bno, &ptr, 1)) < 0)
+			goto fail;
+		if (*ptr == 0 && (r = file_alloc_block(f, bno, ptr,
+				bno == old_nblocks ? run : 0)) < 0)
+			goto fail;
+	}
+	return file_set_size(f, newsize);
+
+fail:
+	// Give back whatever we managed to allocate: the data blocks
+	// below 'bno', then any indirect blocks past the old size.
+	for (; bno > old_nblocks; bno--)
+		file_clear_block(f, bno - 1);
+	file_truncate_blocks(f, f->f_size);
+	return r;
+}
+
 int
 file_set_size(struct File *f, off_t newsize)
 {
-	if (f->f_size > newsize)
+	if (f->f_size > newsize) {
+		if (f->f_type == FTYPE_DIR)
+			dir_cache_flush();
 		file_truncate_blocks(f, newsize);
+	}
 	f->f_size = newsize;
+	file_mark_dirty(f);
 	if (f->f_dir)
 		file_flush(f->f_dir);
 	return 0;
@@ -628,14 +1296,50 @@ file_flush(struct File *f)
 	}	
 }
 
-// Sync the entire file system.  A big hammer.
-void
+// Sort an array of block numbers into ascending order (Shell sort).
+static void
+sort_blocks(uint32_t *a, int n)
+{
+	int gap, i, j;
+	uint32_t t;
+
+	for (gap = n / 2; gap > 0; gap /= 2)
+		for (i = gap; i < n; i++) {
+			t = a[i];
+			for (j = i; j >= gap && a[j - gap] > t; j -= gap)
+				a[j] = a[j - gap];
+			a[j] = t;
+		}
+}
+
+// Sync the entire file system.
+// Only blocks recorded by block_mark_dirty() can be dirty, so we visit
+// just those, in ascending order to keep the disk head moving one way.
+//
+// Other threads may mark blocks dirty while we wait for the disk;
+// those land past the part of the list being synced and are kept.
+// Returns the number of blocks written.
+int
 fs_sync(void)
 {
-	int i;
-	for (i = 0; i < super->s_nblocks; i++)
-		if (block_is_dirty(i))
-			write_block(i);
+	int i, n, nwritten = 0;
+	uint32_t bno;
+
+	lock_acquire(&sync_lock);
+	n = ndirty;
+	sort_blocks(dirtylist, n);
+	for (i = 0; i < n; i++) {
+		bno = dirtylist[i];
+		dirtybits[bno / 32] &= ~(1 << (bno % 32));
+		if (block_is_dirty(bno)) {
+			write_block(bno);
+			nwritten++;
+		}
+	}
+	memmove(dirtylist, dirtylist + n, (ndirty - n) * sizeof(dirtylist[0]));
+	ndirty -= n;
+	lock_release(&sync_lock);
+	return nwritten;
 }
 
 // Close a file.
@@ -657,9 +1361,14 @@ file_remove(const char *path)
 	if ((r = walk_path(path, 0, &f, 0)) < 0)
 		return r;
 
+	if (f->f_type == FTYPE_DIR)
+		dir_cache_flush();
+	dir_index_remove(f);
+	dcache_enter(f->f_dir, f->f_name, 0);
 	file_truncate_blocks(f, 0);
 	f->f_name[0] = '\0';
 	f->f_size = 0;
+	file_mark_dirty(f);
 	if (f->f_dir)
 		file_flush(f->f_dir);
 
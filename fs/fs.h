@@ -18,20 +18,26 @@ int	ide_read(uint32_t secno, void *dst, size_t nsecs);
 int	ide_write(uint32_t secno, const void *src, size_t nsecs);
 
 /* fs.c */
+void	lock_acquire(volatile uint32_t *lock);
+void	lock_release(volatile uint32_t *lock);
 int	file_create(const char *path, struct File **f);
 int	file_open(const char *path, struct File **f);
 int	file_get_block(struct File *f, uint32_t file_blockno, char **pblk);
 int	file_set_size(struct File *f, off_t newsize);
+int	file_allocate(struct File *f, off_t newsize);
 void	file_flush(struct File *f);
 void	file_close(struct File *f);
 int	file_remove(const char *path);
 void	fs_init(void);
 int	file_dirty(struct File *f, off_t offset);
-void	fs_sync(void);
+int	fs_sync(void);
 
 extern uint32_t *bitmap;
 int	map_block(uint32_t);
 int	alloc_block(void);
+int	alloc_block_near(uint32_t hint);
+void	block_mark_dirty(uint32_t blockno);
+void	file_mark_dirty(struct File *f);
 
 /* test.c */
 void	fs_test(void);
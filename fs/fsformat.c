@@ -34,6 +34,9 @@ typedef int bool;
 #include <inc/fs.h>
 
 #define nelem(x)	(sizeof(x) / sizeof((x)[0]))
+
+// Largest disk the file server can map (DISKSIZE in fs/fs.h)
+#define MAXBLOCKS	(0xC0000000 / BLKSIZE)
 typedef struct Super Super;
 typedef struct File File;
 
@@ -108,6 +111,7 @@ swizzlefile(struct File *f)
 	for (i = 0; i < NDIRECT; i++)
 		swizzle(&f->f_direct[i]);
 	swizzle(&f->f_indirect);
+	swizzle(&f->f_dindirect);
 }
 
 void
@@ -265,6 +269,24 @@ storeblk(struct File *f, struct Block *b, int nblk)
 			bindir = getblk(f->f_indirect, 0, BLOCK_BITS);
 		((uint32_t*)bindir->buf)[nblk] = b->bno;
 		putblk(bindir);
+	} else if (nblk < NINDIRECT + NDINDIRECT) {
+		struct Block *bdindir, *bindir;
+		uint32_t *slot;
+		nblk -= NINDIRECT;
+		if (f->f_dindirect == 0) {
+			bdindir = getblk(nextb++, 1, BLOCK_BITS);
+			f->f_dindirect = bdindir->bno;
+		} else
+			bdindir = getblk(f->f_dindirect, 0, BLOCK_BITS);
+		slot = &((uint32_t*)bdindir->buf)[nblk / NINDIRECT];
+		if (*slot == 0) {
+			bindir = getblk(nextb++, 1, BLOCK_BITS);
+			*slot = bindir->bno;
+		} else
+			bindir = getblk(*slot, 0, BLOCK_BITS);
+		((uint32_t*)bindir->buf)[nblk % NINDIRECT] = b->bno;
+		putblk(bindir);
+		putblk(bdindir);
 	} else {
 		fprintf(stderr, "file too large\n");
 		abort();
@@ -470,7 +492,7 @@ main(int argc, char **argv)
 		usage();
 
 	nblocks = strtol(argv[2], &s, 0);
-	if (*s || s == argv[2] || nblocks < 2 || nblocks > 1024)
+	if (*s || s == argv[2] || nblocks < 2 || nblocks > MAXBLOCKS)
 		usage();
 	
 	opendisk(argv[1]);
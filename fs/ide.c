@@ -6,21 +6,31 @@
 
 #include "fs.h"
 #include <inc/x86.h>
+#include <arch/thread.h>
 
 #define IDE_BSY		0x80
 #define IDE_DRDY	0x40
 #define IDE_DF		0x20
 #define IDE_ERR		0x01
 
+// Polls of a busy drive before waiting for it a clock tick at a time
+#define IDE_SPINS	16
+
 static int diskno = 1;
 
 static int
 ide_wait_ready(bool check_error)
 {
-	int r;
-
-	while (((r = inb(0x1F7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
-		/* do nothing */;
+	int r, i;
+
+	// Let other request threads run while the drive is busy.  If it
+	// stays busy, sleep, so that the server can block for new
+	// requests instead of yielding to us over and over.
+	for (i = 0; ((r = inb(0x1F7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY; i++)
+		if (i < IDE_SPINS)
+			thread_yield();
+		else
+			thread_wait(0, 0, time_msec() + 1);
 
 	if (check_error && (r & (IDE_DF|IDE_ERR)) != 0)
 		return -1;
@@ -5,6 +5,7 @@
 
 #include <inc/x86.h>
 #include <inc/string.h>
+#include <arch/thread.h>
 
 #include "fs.h"
 
@@ -16,53 +17,138 @@ struct OpenFile {
 	struct File *o_file;	// mapped descriptor for open file
 	int o_mode;		// open mode
 	struct Fd *o_fd;	// Fd page
+	struct OpenFile *o_next;	// next on openfree or openclosed
+	bool o_listed;		// on openfree or openclosed
 };
 
-// Max number of open files in the file system at once
-#define MAXOPEN		1024
-#define FILEVA		0xD0000000
+// Max number of open files in the file system at once.
+// Their Fd pages are at FILEVA, above the client request rings.
+#define MAXOPEN		4096
+#define FILEVA		0xD0C00000
 
 // initialize to force into data section
 struct OpenFile opentab[MAXOPEN] = {
 	{ 0, 0, 1, 0 }
 };
 
-// Virtual address at which to receive page mappings containing client requests.
-#define REQVA		0x0ffff000
+// An open-file slot is free when no client maps its Fd page.  Slots
+// known to be free are on openfree.  serve_close cannot tell whether
+// the closing client was the last one mapping the page (it unmaps the
+// page after we reply, and dup'd or inherited descriptors share it),
+// so closed slots go on openclosed and are checked when they are
+// needed.  Slots left behind by clients that exited without closing
+// are found by openfile_sweep once both lists run dry.
+static struct OpenFile *openfree;
+static struct OpenFile *openclosed;
+
+// Each request is served by its own thread, so that one waiting for
+// the disk lets the others run.  Request pages are received at
+// REQVA + i*PGSIZE for a free slot i, and freed when the thread ends.
+#define MAXREQ		16
+#define REQVA		(0x0ffff000 - MAXREQ * PGSIZE)
+
+static bool reqbusy[MAXREQ];
+static uint32_t nbusy;		// request threads not yet finished
+
+struct st_args {
+	uint32_t req;
+	envid_t whom;
+	void *va;
+};
+
+// Requests that change a file hold its lock, hashed on the File's
+// address (a collision only costs some needless waiting), and requests
+// that walk or change the directory tree hold ns_lock.
+#define NFLOCK		64
+
+static volatile uint32_t flocks[NFLOCK];
+static volatile uint32_t ns_lock;
+
+static volatile uint32_t*
+file_lock(struct File *f)
+{
+	return &flocks[((uintptr_t) f / sizeof(struct File)) % NFLOCK];
+}
+
+// A client's request ring, if it set one up, is mapped at RINGVA(i)
+// for the client's environment index i.  (STAGEVA, in fs.c, sits just
+// below.)  r_sqhead and r_cqtail are our own copies of the ring's
+// indices, which the client could scribble on.
+#define RINGVA(i)	((struct Fsring*) (0xD0800000 + (i)*PGSIZE))
+
+struct Ring {
+	envid_t r_envid;	// owner, or 0 if no ring is mapped
+	uint32_t r_sqhead;
+	uint32_t r_cqtail;
+	volatile uint32_t r_lock;	// held while the ring is set up or served
+};
+
+static struct Ring rings[NENV];
+
+static void
+openfile_push(struct OpenFile **list, struct OpenFile *o)
+{
+	o->o_next = *list;
+	o->o_listed = 1;
+	*list = o;
+}
 
 void
 serve_init(void)
 {
 	int i;
-	uintptr_t va = FILEVA;
-	for (i = 0; i < MAXOPEN; i++) {
+	for (i = MAXOPEN - 1; i >= 0; i--) {
 		opentab[i].o_fileid = i;
-		opentab[i].o_fd = (struct Fd*) va;
-		va += PGSIZE;
+		opentab[i].o_fd = (struct Fd*) (FILEVA + i * PGSIZE);
+		openfile_push(&openfree, &opentab[i]);
 	}
 }
 
-// Allocate an open file.
+// Put every unlisted slot that no client maps on openfree.
+static void
+openfile_sweep(void)
+{
+	int i;
+
+	for (i = 0; i < MAXOPEN; i++)
+		if (!opentab[i].o_listed && pageref(opentab[i].o_fd) <= 1)
+			openfile_push(&openfree, &opentab[i]);
+}
+
+// Allocate an open file.  The caller must hand its Fd page to the
+// client before yielding to another thread, or the slot would look
+// free again.
 int
-openfile_alloc(struct OpenFile **o)
+openfile_alloc(struct OpenFile **po)
 {
-	int i, r;
-
-	// Find an available open-file table entry
-	for (i = 0; i < MAXOPEN; i++) {
-		switch (pageref(opentab[i].o_fd)) {
-		case 0:
-			if ((r = sys_page_alloc(0, opentab[i].o_fd, PTE_P|PTE_U|PTE_W)) < 0)
-				return r;
-			/* fall through */
-		case 1:
-			opentab[i].o_fileid += MAXOPEN;
-			*o = &opentab[i];
-			memset(opentab[i].o_fd, 0, PGSIZE);
-			return (*o)->o_fileid;
-		}
+	int r;
+	struct OpenFile *o;
+
+	// Find an available open-file table entry, checking closed ones
+	// before falling back to a sweep of the whole table.  A closed
+	// slot that is still mapped is dropped; its last unmapping will
+	// be found by a sweep.
+	while (!openfree && openclosed) {
+		o = openclosed;
+		openclosed = o->o_next;
+		o->o_listed = 0;
+		if (pageref(o->o_fd) <= 1)
+			openfile_push(&openfree, o);
 	}
-	return -E_MAX_OPEN;
+	if (!openfree)
+		openfile_sweep();
+	if (!(o = openfree))
+		return -E_MAX_OPEN;
+
+	if (pageref(o->o_fd) == 0
+	    && (r = sys_page_alloc(0, o->o_fd, PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	openfree = o->o_next;
+	o->o_listed = 0;
+	o->o_fileid += MAXOPEN;
+	memset(o->o_fd, 0, PGSIZE);
+	*po = o;
+	return o->o_fileid;
 }
 
 // Look up an open file for envid.
@@ -72,7 +158,7 @@ openfile_lookup(envid_t envid, uint32_t fileid, struct OpenFile **po)
 	struct OpenFile *o;
 
 	o = &opentab[fileid % MAXOPEN];
-	if (pageref(o->o_fd) == 1 || o->o_fileid != fileid)
+	if (pageref(o->o_fd) <= 1 || o->o_fileid != fileid)
 		return -E_INVAL;
 	*po = o;
 	return 0;
@@ -84,7 +170,7 @@ openfile_lookup(envid_t envid, uint32_t fileid, struct OpenFile **po)
 void
 serve_open(envid_t envid, struct Fsreq_open *rq)
 {
-	char path[MAXPATHLEN];
+	char *path;
 	struct File *f;
 	int fileid;
 	int r;
@@ -93,24 +179,28 @@ serve_open(envid_t envid, struct Fsreq_open *rq)
 	if (debug)
 		cprintf("serve_open %08x %s 0x%x\n", envid, rq->req_path, rq->req_omode);
 
-	// Copy in the path, making sure it's null-terminated
-	memmove(path, rq->req_path, MAXPATHLEN);
+	// Make sure the path is null-terminated.  The request page is
+	// this thread's own, so there is no need to copy it.
+	path = rq->req_path;
 	path[MAXPATHLEN-1] = 0;
 
-	// Find an open file ID
-	if ((r = openfile_alloc(&o)) < 0) {
+	// Open the file
+	lock_acquire(&ns_lock);
+	r = file_open(path, &f);
+	lock_release(&ns_lock);
+	if (r < 0) {
 		if (debug)
-			cprintf("openfile_alloc failed: %e", r);
+			cprintf("file_open failed: %e", r);
 		goto out;
 	}
-	fileid = r;
 
-	// Open the file
-	if ((r = file_open(path, &f)) < 0) {
+	// Find an open file ID.  Nothing from here on may yield.
+	if ((r = openfile_alloc(&o)) < 0) {
 		if (debug)
-			cprintf("file_open failed: %e", r);
+			cprintf("openfile_alloc failed: %e", r);
 		goto out;
 	}
+	fileid = r;
 
 	// Save the file pointer
 	o->o_file = f;
@@ -130,7 +220,7 @@ out:
 	ipc_send(envid, r, 0, 0);
 }
 
-void
+int
 serve_set_size(envid_t envid, struct Fsreq_set_size *rq)
 {
 	struct OpenFile *o;
@@ -170,23 +260,47 @@ serve_set_size(envid_t envid, struct Fsreq_set_size *rq)
 	// Here's how it goes.
 
 	// First, use openfile_lookup to find the relevant open file.
-	// On failure, return the error code to the client with ipc_send.
+	// On failure, return the error code, which serve_thread sends
+	// back to the client (requests that send a page reply themselves).
 	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
-		goto out;
+		return r;
 
 	// Second, call the relevant file system function (from fs/fs.c).
 	// On failure, return the error code to the client.
-	if ((r = file_set_size(o->o_file, rq->req_size)) < 0)
-		goto out;
+	lock_acquire(file_lock(o->o_file));
+	r = file_set_size(o->o_file, rq->req_size);
+	lock_release(file_lock(o->o_file));
+	if (r < 0)
+		return r;
 
 	// Third, update the 'struct Fd' copy of the 'struct File'
 	// as appropriate.
 	o->o_fd->fd_file.file.f_size = rq->req_size;
 
 	// Finally, return to the client!
-	// (We just return r since we know it's 0 at this point.)
-out:
-	ipc_send(envid, r, 0, 0);
+	return 0;
+}
+
+// Like serve_set_size, but reserves all the file's blocks up front,
+// contiguously where possible.
+int
+serve_allocate(envid_t envid, struct Fsreq_allocate *rq)
+{
+	struct OpenFile *o;
+	int r;
+
+	if (debug)
+		cprintf("serve_allocate %08x %08x %08x\n", envid, rq->req_fileid, rq->req_size);
+
+	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
+		return r;
+	lock_acquire(file_lock(o->o_file));
+	r = file_allocate(o->o_file, rq->req_size);
+	lock_release(file_lock(o->o_file));
+	if (r < 0)
+		return r;
+	o->o_fd->fd_file.file.f_size = o->o_file->f_size;
+	return 0;
 }
 
 // Map the requested block in the client's address space
@@ -211,34 +325,85 @@ serve_map(envid_t envid, struct Fsreq_map *rq)
         if (o->o_mode & (O_WRONLY|O_RDWR))
           perm |= PTE_W;
         
+	lock_acquire(file_lock(o->o_file));
 	r = file_get_block(o->o_file, rq->req_offset/BLKSIZE, &blk);
+	lock_release(file_lock(o->o_file));
 
 out:
 	ipc_send(envid, r, blk, perm);
 }
 
+// Map up to rq->req_npages consecutive blocks of the file, starting at
+// the block holding rq->req_offset, in one reply.  Stops at the end of
+// the file or at the first block that cannot be read, and returns the
+// number of blocks mapped.
 void
-serve_close(envid_t envid, struct Fsreq_close *rq)
+serve_map_range(envid_t envid, struct Fsreq_map_range *rq)
 {
+	int r, perm;
+	uint32_t i, n, filebno, nblocks;
+	char *blk;
+	void **blks;
 	struct OpenFile *o;
-	int r;
 
 	if (debug)
-		cprintf("serve_close %08x %08x\n", envid, rq->req_fileid);
+		cprintf("serve_map_range %08x %08x %08x %d\n", envid, rq->req_fileid, rq->req_offset, rq->req_npages);
 
 	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
 		goto out;
-	file_close(o->o_file);
-	r = 0;
+
+	perm = PTE_U | PTE_P | PTE_SHARE;
+	if (o->o_mode & (O_WRONLY|O_RDWR))
+		perm |= PTE_W;
+
+	// The request page is ours alone, so reuse it for the list of
+	// blocks to send.
+	filebno = rq->req_offset / BLKSIZE;
+	nblocks = ROUNDUP(o->o_file->f_size, BLKSIZE) / BLKSIZE;
+	n = MIN(rq->req_npages, PGSIZE / sizeof(void*));
+	n = filebno < nblocks ? MIN(n, nblocks - filebno) : 0;
+	blks = (void**) rq;
+
+	lock_acquire(file_lock(o->o_file));
+	for (i = 0; i < n; i++) {
+		if ((r = file_get_block(o->o_file, filebno + i, &blk)) < 0)
+			break;
+		blks[i] = blk;
+	}
+	lock_release(file_lock(o->o_file));
+	if (i == 0 && n > 0)
+		goto out;
+	ipc_send_pages(envid, i, blks, i, perm);
+	return;
 
 out:
 	ipc_send(envid, r, 0, 0);
 }
 
+int
+serve_close(envid_t envid, struct Fsreq_close *rq)
+{
+	struct OpenFile *o;
+	int r;
+
+	if (debug)
+		cprintf("serve_close %08x %08x\n", envid, rq->req_fileid);
+
+	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
+		return r;
+	lock_acquire(file_lock(o->o_file));
+	file_close(o->o_file);
+	lock_release(file_lock(o->o_file));
+	if (!o->o_listed)
+		openfile_push(&openclosed, o);
+	return 0;
+}
+
 void
 serve_remove(envid_t envid, struct Fsreq_remove *rq)
 {
-	char path[MAXPATHLEN];
+	char *path;
+	struct File *f;
 	int r;
 
 	if (debug)
@@ -248,17 +413,23 @@ serve_remove(envid_t envid, struct Fsreq_remove *rq)
 	// Note: This request doesn't refer to an open file.
 	// Hint: Make sure the path is null-terminated!
 
-	// Copy in the path, making sure it's null-terminated
-	memmove(path, rq->req_path, MAXPATHLEN);
+	// Make sure the path is null-terminated
+	path = rq->req_path;
 	path[MAXPATHLEN-1] = 0;
 
-	// Delete the specified file
-	r = file_remove(path);
+	// Delete the specified file, waiting out any request using it
+	lock_acquire(&ns_lock);
+	if ((r = file_open(path, &f)) == 0) {
+		lock_acquire(file_lock(f));
+		r = file_remove(path);
+		lock_release(file_lock(f));
+	}
+	lock_release(&ns_lock);
 	ipc_send(envid, r, 0, 0);
 }
 
 // Mark the page containing the requested file offset as dirty.
-void
+int
 serve_dirty(envid_t envid, struct Fsreq_dirty *rq)
 {
 	struct OpenFile *o;
@@ -268,71 +439,209 @@ serve_dirty(envid_t envid, struct Fsreq_dirty *rq)
 		cprintf("serve_dirty %08x %08x %08x\n", envid, rq->req_fileid, rq->req_offset);
 
 	if ((r = openfile_lookup(envid, rq->req_fileid, &o)) < 0)
-		goto out;
+		return r;
 
+	lock_acquire(file_lock(o->o_file));
 	r = file_dirty(o->o_file, rq->req_offset);
+	lock_release(file_lock(o->o_file));
+	return r;
+}
+
+int
+serve_sync(envid_t envid)
+{
+	return fs_sync();
+}
+
+// Serve one of the requests that can also arrive through a ring.
+static int
+serve_simple(envid_t envid, uint32_t req, void *rq)
+{
+	switch (req) {
+	case FSREQ_SET_SIZE:
+		return serve_set_size(envid, (struct Fsreq_set_size*)rq);
+	case FSREQ_CLOSE:
+		return serve_close(envid, (struct Fsreq_close*)rq);
+	case FSREQ_DIRTY:
+		return serve_dirty(envid, (struct Fsreq_dirty*)rq);
+	case FSREQ_SYNC:
+		return serve_sync(envid);
+	case FSREQ_ALLOCATE:
+		return serve_allocate(envid, (struct Fsreq_allocate*)rq);
+	default:
+		return -E_INVAL;
+	}
+}
+
+// Keep the page at 'va' as envid's request ring, replacing any ring
+// the environment, or an earlier one in the same slot, had.
+int
+serve_ring_setup(envid_t envid, void *va)
+{
+	int r;
+	struct Ring *rg = &rings[ENVX(envid)];
+
+	if (debug)
+		cprintf("serve_ring_setup %08x\n", envid);
 
+	lock_acquire(&rg->r_lock);
+	if ((r = sys_page_map(0, va, 0, RINGVA(ENVX(envid)), PTE_P|PTE_U|PTE_W)) < 0)
+		goto out;
+	rg->r_envid = envid;
+	rg->r_sqhead = RINGVA(ENVX(envid))->sq_head;
+	rg->r_cqtail = RINGVA(ENVX(envid))->cq_tail;
 out:
-	ipc_send(envid, r, 0, 0);
+	lock_release(&rg->r_lock);
+	return r;
 }
 
-void
-serve_sync(envid_t envid)
+// Serve the requests queued in envid's ring, at most one ring's worth,
+// and return how many were served.  Each request is copied out before
+// it is looked at, since the client can change the ring under us.
+// serve_simple can wait for the disk, so the ring stays locked until
+// we are done: another FSREQ_RING_ENTER from the same environment
+// would otherwise serve the same entries again.
+int
+serve_ring_enter(envid_t envid)
+{
+	int n;
+	struct Ring *rg = &rings[ENVX(envid)];
+	struct Fsring *ring = RINGVA(ENVX(envid));
+	struct Fsring_sqe sqe;
+	struct Fsring_cqe *cqe;
+
+	if (debug)
+		cprintf("serve_ring_enter %08x\n", envid);
+
+	lock_acquire(&rg->r_lock);
+	if (rg->r_envid != envid) {
+		lock_release(&rg->r_lock);
+		return -E_INVAL;
+	}
+	for (n = 0; n < FSRING_SIZE && rg->r_sqhead != ring->sq_tail; n++) {
+		sqe = ring->sq[rg->r_sqhead % FSRING_SIZE];
+		cqe = &ring->cq[rg->r_cqtail % FSRING_SIZE];
+		cqe->cqe_index = rg->r_sqhead;
+		cqe->cqe_result = serve_simple(envid, sqe.sqe_type, &sqe.sqe_req);
+		rg->r_sqhead++;
+		rg->r_cqtail++;
+	}
+	ring->sq_head = rg->r_sqhead;
+	ring->cq_tail = rg->r_cqtail;
+	lock_release(&rg->r_lock);
+	return n;
+}
+
+static void
+serve_thread(uint32_t a)
 {
-	fs_sync();
-	ipc_send(envid, 0, 0, 0);
+	struct st_args *args = (struct st_args*) a;
+	void *va = args->va;
+
+	switch (args->req) {
+	case FSREQ_OPEN:
+		serve_open(args->whom, (struct Fsreq_open*)va);
+		break;
+	case FSREQ_MAP:
+		serve_map(args->whom, (struct Fsreq_map*)va);
+		break;
+	case FSREQ_SET_SIZE:
+	case FSREQ_CLOSE:
+	case FSREQ_DIRTY:
+	case FSREQ_SYNC:
+	case FSREQ_ALLOCATE:
+		ipc_send(args->whom, serve_simple(args->whom, args->req, va), 0, 0);
+		break;
+	case FSREQ_REMOVE:
+		serve_remove(args->whom, (struct Fsreq_remove*)va);
+		break;
+	case FSREQ_MAP_RANGE:
+		serve_map_range(args->whom, (struct Fsreq_map_range*)va);
+		break;
+	case FSREQ_RING_SETUP:
+		ipc_send(args->whom, serve_ring_setup(args->whom, va), 0, 0);
+		break;
+	case FSREQ_RING_ENTER:
+		ipc_send(args->whom, serve_ring_enter(args->whom), 0, 0);
+		break;
+	default:
+		cprintf("Invalid request code %d from %08x\n", args->whom, args->req);
+		break;
+	}
+	sys_page_unmap(0, va);
+	reqbusy[((uintptr_t) va - REQVA) / PGSIZE] = 0;
+	nbusy--;
+	thread_wakeup(&nbusy);
+	free(args);
 }
 
 void
 serve(void)
 {
 	uint32_t req, whom;
-	int perm;
+	int i, perm;
+	size_t npages;
+	void *va;
+	struct st_args *args;
 	
 	while (1) {
+		// With every request page taken, wait for a thread to end.
+		while (nbusy == MAXREQ)
+			thread_wait(&nbusy, MAXREQ, (uint32_t) ~0);
+
+		for (i = 0; i < MAXREQ && reqbusy[i]; i++)
+			;
+		if (i == MAXREQ)
+			panic("serve: no free request page");
+		va = (void*) (REQVA + i * PGSIZE);
+
+		// ipc_recv blocks the whole environment, so block only
+		// until some request thread can run again: not at all if
+		// one can run now, else until the first one's sleep ends.
+		// Meanwhile new requests come in alongside those waiting
+		// for the disk or a lock.
 		perm = 0;
-		req = ipc_recv((int32_t *) &whom, (void *) REQVA, &perm);
+		npages = 1;
+		req = ipc_recv_timed((int32_t *) &whom, va, &npages, &perm,
+				     thread_wait_until());
+		if ((int32_t) req == -E_TIMEOUT) {
+			thread_yield();
+			continue;
+		}
 		if (debug)
 			cprintf("fs req %d from %08x [page %08x: %s]\n",
-				req, whom, vpt[VPN(REQVA)], REQVA);
+				req, whom, vpt[VPN(va)], va);
 
-		// All requests must contain an argument page
-		if (!(perm & PTE_P)) {
+		// All requests but FSREQ_RING_ENTER, whose arguments are
+		// in the client's ring, must contain an argument page
+		if (!(perm & PTE_P) && req != FSREQ_RING_ENTER) {
 			cprintf("Invalid request from %08x: no argument page\n",
 				whom);
 			continue; // just leave it hanging...
 		}
 
-		switch (req) {
-		case FSREQ_OPEN:
-			serve_open(whom, (struct Fsreq_open*)REQVA);
-			break;
-		case FSREQ_MAP:
-			serve_map(whom, (struct Fsreq_map*)REQVA);
-			break;
-		case FSREQ_SET_SIZE:
-			serve_set_size(whom, (struct Fsreq_set_size*)REQVA);
-			break;
-		case FSREQ_CLOSE:
-			serve_close(whom, (struct Fsreq_close*)REQVA);
-			break;
-		case FSREQ_DIRTY:
-			serve_dirty(whom, (struct Fsreq_dirty*)REQVA);
-			break;
-		case FSREQ_REMOVE:
-			serve_remove(whom, (struct Fsreq_remove*)REQVA);
-			break;
-		case FSREQ_SYNC:
-			serve_sync(whom);
-			break;
-		default:
-			cprintf("Invalid request code %d from %08x\n", whom, req);
-			break;
-		}
-		sys_page_unmap(0, (void*) REQVA);
+		if ((args = malloc(sizeof(struct st_args))) == 0)
+			panic("serve: could not allocate thread arguments");
+		args->req = req;
+		args->whom = whom;
+		args->va = va;
+		reqbusy[i] = 1;
+		nbusy++;
+		if (thread_create(0, "serve_thread", serve_thread, (uint32_t) args,
+				  THREAD_PRIO_NORMAL) < 0)
+			panic("serve: could not create request thread");
+		thread_yield();	// let the new thread run
 	}
 }
 
+// The thread library can only switch between threads it created,
+// so the server loop runs in one too.
+static void
+tmain(uint32_t arg)
+{
+	serve();
+}
+
 void
 umain(void)
 {
@@ -348,6 +657,8 @@ umain(void)
 	fs_init();
 	fs_test();
 
-	serve();
+	thread_init();
+	thread_create(0, "main", tmain, 0, THREAD_PRIO_NORMAL);
+	thread_yield();
 }
 
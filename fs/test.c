@@ -19,10 +19,12 @@ static char *msg = "This is the NEW message of the day!\n\n";
 void
 fs_test(void)
 {
-	struct File *f;
-	int r;
+	struct File *f, *f2;
+	int i, n, r;
 	char *blk;
 	uint32_t *bits;
+	unsigned start;
+	char path[MAXNAMELEN];
 
 	// back up bitmap
 	if ((r = sys_page_alloc(0, (void*) PGSIZE, PTE_P|PTE_U|PTE_W)) < 0)
@@ -76,4 +78,84 @@ fs_test(void)
 	file_close(f);
 	assert(!(vpt[VPN(f)] & PTE_D));	
 	cprintf("file rewrite is good\n");
+
+	if ((r = file_dirty(f, 0)) < 0)
+		panic("file_dirty: %e", r);
+	assert((vpt[VPN(blk)] & PTE_D));
+	fs_sync();
+	assert(!(vpt[VPN(blk)] & PTE_D));
+	cprintf("fs_sync is good\n");
+
+	if ((r = file_create("/fs-test-alloc", &f)) < 0)
+		panic("file_create: %e", r);
+	if ((r = file_allocate(f, 8*BLKSIZE)) < 0)
+		panic("file_allocate: %e", r);
+	assert(f->f_size == 8*BLKSIZE);
+	for (i = 1; i < 8; i++)
+		assert(f->f_direct[i] == f->f_direct[0] + i);
+	if ((r = file_remove("/fs-test-alloc")) < 0)
+		panic("file_remove: %e", r);
+	cprintf("file_allocate is good\n");
+
+	// write a file that reaches into the double-indirect block
+	// and read it back, timing the sequential pass
+	n = NINDIRECT + 16;
+	if ((r = file_create("/fs-test-big", &f)) < 0)
+		panic("file_create: %e", r);
+	if ((r = file_set_size(f, n*BLKSIZE)) < 0)
+		panic("file_set_size: %e", r);
+	start = sys_time_msec();
+	for (i = 0; i < n; i++) {
+		if ((r = file_get_block(f, i, &blk)) < 0)
+			panic("file_get_block %d: %e", i, r);
+		memset(blk, i, BLKSIZE);
+		*(uint32_t*) blk = i;
+	}
+	file_flush(f);
+	assert(f->f_dindirect != 0);
+	for (i = 0; i < n; i++) {
+		if ((r = file_get_block(f, i, &blk)) < 0)
+			panic("file_get_block %d: %e", i, r);
+		assert(*(uint32_t*) blk == i && blk[BLKSIZE-1] == (char) i);
+	}
+	cprintf("large file: %d KB in %d ms\n", n*BLKSIZE/1024,
+		sys_time_msec() - start);
+	if ((r = file_set_size(f, NINDIRECT*BLKSIZE)) < 0)
+		panic("file_set_size: %e", r);
+	assert(f->f_dindirect == 0);
+	if ((r = file_remove("/fs-test-big")) < 0)
+		panic("file_remove: %e", r);
+	cprintf("large file is good\n");
+
+	// fill a few directory blocks through the index, then empty them
+	for (i = 0; i < 3*BLKFILES; i++) {
+		snprintf(path, sizeof(path), "/fs-test-dir%d", i);
+		if ((r = file_create(path, &f)) < 0)
+			panic("file_create %s: %e", path, r);
+	}
+	for (i = 0; i < 3*BLKFILES; i++) {
+		snprintf(path, sizeof(path), "/fs-test-dir%d", i);
+		if ((r = file_open(path, &f)) < 0)
+			panic("file_open %s: %e", path, r);
+		assert(strcmp(f->f_name, path + 1) == 0);
+		if ((r = file_remove(path)) < 0)
+			panic("file_remove %s: %e", path, r);
+		if ((r = file_open(path, &f)) != -E_NOT_FOUND)
+			panic("file_open %s after remove: %e", path, r);
+	}
+	cprintf("dir index is good\n");
+
+	// a cached miss must not hide a later create, nor a hit a remove
+	if ((r = file_open("/fs-test-dcache", &f)) != -E_NOT_FOUND)
+		panic("file_open /fs-test-dcache: %e", r);
+	if ((r = file_create("/fs-test-dcache", &f)) < 0)
+		panic("file_create /fs-test-dcache: %e", r);
+	if ((r = file_open("/fs-test-dcache", &f2)) < 0)
+		panic("file_open /fs-test-dcache: %e", r);
+	assert(f2 == f);
+	if ((r = file_remove("/fs-test-dcache")) < 0)
+		panic("file_remove /fs-test-dcache: %e", r);
+	if ((r = file_open("/fs-test-dcache", &f)) != -E_NOT_FOUND)
+		panic("file_open /fs-test-dcache after remove: %e", r);
+	cprintf("dcache is good\n");
 }
@@ -53,8 +53,33 @@ runtest1 -tag 'primespipe' primespipe \
 	! 30 31 ! 32 ! 33 ! 34 ! 35 ! 36 37 ! 38 ! 39 \
 	541 1009 1097
 
-echo "Score: $score/70"
+# 5 points - run-testmmap
+pts=5
+timeout=30
+runtest1 -tag 'mmap [testmmap]' testmmap \
+	'mmap reads right' \
+	'MAP_PRIVATE handles writes right' \
+	'munmap is good' \
 
-if [ $score -lt 70 ]; then
+# 5 points - run-testfsring
+pts=5
+runtest1 -tag 'fs request ring [testfsring]' testfsring \
+	'fsring writes right' \
+	'fsring after fork is good' \
+	'fsring reports errors right' \
+
+# 5 points - run-testrecvtimed
+pts=5
+runtest1 -tag 'timed receive [testrecvtimed]' testrecvtimed \
+	'timed receive is good' \
+
+# 5 points - run-testtimensec
+pts=5
+runtest1 -tag 'user-level clock [testtimensec]' testtimensec \
+	'TSC at [0-9]* kHz; time_nsec is good' \
+
+echo "Score: $score/90"
+
+if [ $score -lt 90 ]; then
     exit 1
 fi
@@ -53,9 +53,16 @@ struct Env {
 	// Lab 4 IPC
 	bool env_ipc_recving;		// env is blocked receiving
 	void *env_ipc_dstva;		// va at which to map received page
+	uint32_t env_ipc_npages;	// pages receivable at dstva; then received
 	uint32_t env_ipc_value;		// data value sent to us 
 	envid_t env_ipc_from;		// envid of the sender	
 	int env_ipc_perm;		// perm of page mapping received
+	bool env_ipc_notified;		// a kernel notification awaits receipt
+	uint32_t env_ipc_notify_value;	// its value
+
+	// Timed receives
+	LIST_ENTRY(Env) env_alarm_link;	// Timer wheel link pointers
+	uint32_t env_alarm_tick;	// tick the receive or sleep ends, or 0
 };
 
 #endif // !JOS_INC_ENV_H
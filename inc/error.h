@@ -24,6 +24,11 @@
 #define E_FILE_EXISTS	13	// File already exists
 #define E_NOT_EXEC	14	// File not a valid executable
 
-#define MAXERROR	14
+// Network error codes -- only seen in user-level
+#define E_WOULD_BLOCK	15	// Non-blocking socket operation would block
+
+#define E_TIMEOUT	16	// Timed IPC receive got no message in time
+
+#define MAXERROR	16
 
 #endif	// !JOS_INC_ERROR_H */
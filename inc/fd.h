@@ -49,6 +49,7 @@ int	fd2num(struct Fd *fd);
 int	fd_alloc(struct Fd **fd_store);
 int	fd_close(struct Fd *fd, bool must_exist);
 int	fd_lookup(int fdnum, struct Fd **fd_store);
+int	fd_data_lookup(void *va, struct Fd **fd_store);
 int	dev_lookup(int devid, struct Dev **dev_store);
 
 extern struct Dev devcons;
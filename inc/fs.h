@@ -22,8 +22,12 @@
 #define NDIRECT		10
 // Number of direct block pointers in an indirect block
 #define NINDIRECT	(BLKSIZE / 4)
+// Number of file blocks reachable through the double-indirect block
+#define NDINDIRECT	(NINDIRECT * NINDIRECT)
 
-#define MAXFILESIZE	(NINDIRECT * BLKSIZE)
+// (NINDIRECT + NDINDIRECT) * BLKSIZE would overflow off_t,
+// so the largest off_t, rounded down to a block, is the limit.
+#define MAXFILESIZE	(0x7FFFFFFF & ~(BLKSIZE - 1))
 
 struct File {
 	char f_name[MAXNAMELEN];	// filename
@@ -39,10 +43,17 @@ struct File {
 	// Meaningful only in memory; the value on disk can be garbage.
 	// dir_lookup() sets the value when required.
 	struct File *f_dir;
+	// Give f_dir 8 bytes either way, so the fields below sit at the
+	// same offset when fsformat is compiled on a 64-bit machine.
+	uint8_t f_dir_pad[8 - sizeof(struct File*)];
 
-	// Pad out to 256 bytes; must do arithmetic in case we're compiling
-	// fsformat on a 64-bit machine.
-	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4 - sizeof(struct File*)];
+	// Double-indirect block: an indirect block of indirect blocks,
+	// mapping file blocks NINDIRECT and up.  Taken out of what used
+	// to be padding, which fsformat always zeroed.
+	uint32_t f_dindirect;
+
+	// Pad out to 256 bytes.
+	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4 - 8 - 4];
 } __attribute__((packed));	// required only on some 64-bit machines
 
 // An inode block contains exactly BLKFILES 'struct File's
@@ -72,6 +83,10 @@ struct Super {
 #define FSREQ_DIRTY	5
 #define FSREQ_REMOVE	6
 #define FSREQ_SYNC	7
+#define FSREQ_ALLOCATE	8
+#define FSREQ_MAP_RANGE	9
+#define FSREQ_RING_SETUP 10
+#define FSREQ_RING_ENTER 11
 
 struct Fsreq_open {
 	char req_path[MAXPATHLEN];
@@ -83,11 +98,22 @@ struct Fsreq_map {
 	off_t req_offset;
 };
 
+struct Fsreq_map_range {
+	int req_fileid;
+	off_t req_offset;
+	size_t req_npages;
+};
+
 struct Fsreq_set_size {
 	int req_fileid;
 	off_t req_size;
 };
 
+struct Fsreq_allocate {
+	int req_fileid;
+	off_t req_size;
+};
+
 struct Fsreq_close {
 	int req_fileid;
 };
@@ -101,4 +127,40 @@ struct Fsreq_remove {
 	char req_path[MAXPATHLEN];
 };
 
+// Shared request ring.  A client can hand the file server one page,
+// laid out as a struct Fsring, with FSREQ_RING_SETUP.  From then on it
+// queues requests that carry no path and no page in sq[] and passes
+// them all to the server with a single FSREQ_RING_ENTER, which sends no
+// page.  The server serves them in order, posts a completion for each
+// in cq[], and replies with the number it served.
+//
+// Indices only grow; entry i lives at sq[i % FSRING_SIZE].  The client
+// advances sq_tail and cq_head, the server sq_head and cq_tail.
+
+#define FSRING_SIZE	128
+
+struct Fsring_sqe {
+	uint32_t sqe_type;		// FSREQ_ code
+	union {
+		struct Fsreq_set_size set_size;
+		struct Fsreq_allocate allocate;
+		struct Fsreq_close close;
+		struct Fsreq_dirty dirty;
+	} sqe_req;
+};
+
+struct Fsring_cqe {
+	uint32_t cqe_index;		// index of the request in sq[]
+	int32_t cqe_result;		// what an IPC reply would have been
+};
+
+struct Fsring {
+	volatile uint32_t sq_head;
+	volatile uint32_t sq_tail;
+	volatile uint32_t cq_head;
+	volatile uint32_t cq_tail;
+	struct Fsring_sqe sq[FSRING_SIZE];
+	struct Fsring_cqe cq[FSRING_SIZE];
+};
+
 #endif /* !JOS_INC_FS_H */
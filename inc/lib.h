@@ -22,6 +22,7 @@
 #include <inc/args.h>
 #include <inc/malloc.h>
 #include <inc/ns.h>
+#include <inc/time.h>
 
 #define USED(x)		(void)(x)
 
@@ -30,10 +31,12 @@ extern char *binaryname;
 extern volatile struct Env *env;
 extern volatile struct Env envs[NENV];
 extern volatile struct Page pages[];
+extern const volatile struct Timeinfo timeinfo;
 void	exit(void);
 
 // pgfault.c
 void	set_pgfault_handler(void (*handler)(struct UTrapframe *utf));
+void	add_pgfault_handler(int (*handler)(struct UTrapframe *utf));
 
 // readline.c
 char*	readline(const char *buf);
@@ -54,9 +57,18 @@ int	sys_page_map(envid_t src_env, void *src_pg,
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_try_send_pages(envid_t to_env, uint32_t value, void **pgs, size_t npages, int perm);
+int	sys_ipc_recv_pages(void *rcv_pg, size_t npages);
+int	sys_ipc_recv_timed(void *rcv_pg, size_t npages, unsigned int msec);
 unsigned int sys_time_msec(void);
+int	sys_time_nsec(uint64_t *nsec);
+int	sys_time_sleep(unsigned int msec);
 int     sys_net_txbuf(void *bufva, unsigned int size);
 int     sys_net_rxbuf(void *bufva, unsigned int size);
+int     sys_net_txbufs(void **bufs, unsigned int *sizes, int n);
+int     sys_net_rxbufs(void **bufs, unsigned int *sizes, int n);
+int     sys_net_txfrags(void **bufs, unsigned int *sizes, int n);
+int     sys_net_rxnotify(uint32_t value);
 
 // This must be inlined.  Exercise for reader: why?
 static __inline envid_t sys_exofork(void) __attribute__((always_inline));
@@ -75,6 +87,14 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+void	ipc_send_pages(envid_t to_env, uint32_t value, void **pgs, size_t npages, int perm);
+int32_t ipc_recv_pages(envid_t *from_env_store, void *pg, size_t *npages, int *perm_store);
+int32_t ipc_recv_timed(envid_t *from_env_store, void *pg, size_t *npages, int *perm_store,
+		       unsigned int msec);
+
+// time.c
+uint64_t time_nsec(void);
+unsigned int time_msec(void);
 
 // fork.c
 #define	PTE_SHARE	0x400
@@ -96,17 +116,27 @@ int	stat(const char *path, struct Stat *statbuf);
 int	open(const char *path, int mode);
 int	read_map(int fd, off_t offset, void **blk);
 int	ftruncate(int fd, off_t size);
+int	fallocate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
 
+// mmap.c
+int	mmap(int fd, off_t offset, size_t len, int prot, int flags, void **va_store);
+int	munmap(void *va, size_t len);
+
 // fsipc.c
 int	fsipc_open(const char *path, int omode, struct Fd *fd);
 int	fsipc_map(int fileid, off_t offset, void *dst_va);
+int	fsipc_map_range(int fileid, off_t offset, void *dst_va, size_t npages);
 int	fsipc_set_size(int fileid, off_t size);
+int	fsipc_allocate(int fileid, off_t size);
 int	fsipc_close(int fileid);
 int	fsipc_dirty(int fileid, off_t offset);
 int	fsipc_remove(const char *path);
 int	fsipc_sync(void);
+void	fsring_dirty(int fileid, off_t offset);
+void	fsring_close(int fileid);
+int	fsring_enter(void);
 
 // sockets.c
 int     accept(int s, struct sockaddr *addr, socklen_t *addrlen);
@@ -118,6 +148,10 @@ int     listen(int s, int backlog);
 int     recv(int s, void *mem, int len, unsigned int flags);
 int     send(int s, const void *dataptr, int size, unsigned int flags);
 int     socket(int domain, int type, int protocol);
+int     sendfile(int s, int fdnum, off_t offset, size_t len);
+int     ioctlsocket(int s, long cmd, void *argp);
+int     select(int nfds, fd_set *readset, fd_set *writeset, fd_set *exceptset,
+	       struct timeval *timeout);
 
 // nsipc.c
 int     nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
@@ -129,6 +163,10 @@ int     nsipc_listen(int s, int backlog);
 int     nsipc_recv(int s, void *mem, int len, unsigned int flags);
 int     nsipc_send(int s, const void *dataptr, int size, unsigned int flags);
 int     nsipc_socket(int domain, int type, int protocol);
+int     nsipc_sendfile(int s, int fileid, off_t offset, int size, unsigned int flags);
+int     nsipc_ioctl(int s, long cmd, uint32_t *arg);
+int     nsipc_select(int nfds, fd_set *readset, fd_set *writeset, fd_set *exceptset,
+		     struct timeval *timeout);
 // pageref.c
 int	pageref(void *addr);
 
@@ -160,4 +198,12 @@ void	wait(envid_t env);
 #define	O_EXCL		0x0400		/* error if already exists */
 #define O_MKDIR		0x0800		/* create directory, not regular file */
 
+/* mmap protections and flags */
+#define	PROT_NONE	0x0
+#define	PROT_READ	0x1		/* pages may be read */
+#define	PROT_WRITE	0x2		/* pages may be written */
+
+#define	MAP_SHARED	0x1		/* writes go to the file */
+#define	MAP_PRIVATE	0x2		/* writes stay private (copy-on-write) */
+
 #endif	// !JOS_INC_LIB_H
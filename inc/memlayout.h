@@ -46,7 +46,7 @@
  *    UVPT      ---->  +------------------------------+ 0xef400000
  *                     |          RO PAGES            | R-/R-  PTSIZE
  *    UPAGES    ---->  +------------------------------+ 0xef000000
- *                     |           RO ENVS            | R-/R-  PTSIZE
+ *                     |    RO ENVS (RO TIME at top)  | R-/R-  PTSIZE
  * UTOP,UENVS ------>  +------------------------------+ 0xeec00000
  * UXSTACKTOP -/       |     User Exception Stack     | RW/RW  PGSIZE
  *                     +------------------------------+ 0xeebff000
@@ -109,6 +109,9 @@
 #define UPAGES		(UVPT - PTSIZE)
 // Read-only copies of the global env structures
 #define UENVS		(UPAGES - PTSIZE)
+// Read-only copy of the kernel's clock (a struct Timeinfo, one page),
+// in the last page of the envs slot, past the end of the envs array
+#define UTIME		(UPAGES - PGSIZE)
 
 /*
  * Top of user VM. User can manipulate VA from UTOP-1 and down!
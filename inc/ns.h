@@ -18,12 +18,26 @@
 #define NSREQ_SEND	8
 #define NSREQ_SOCKET	9
 
-// The following two messages pass a page containing a struct jif_pkt
+// The kernel sends the following message, from envid 0 and with no
+// page, when received packets are waiting in the network server's
+// receive buffers
 #define NSREQ_INPUT	10
-#define NSREQ_OUTPUT	11
 
-// The following message passes no page
-#define NSREQ_TIMER	12
+// The request page of the following two messages is followed by up to
+// NSREQ_MAXDATA pages of data to send, which the network server hands
+// to lwIP without copying.  The reply to NSREQ_SENDPAGES, whose pages
+// are the client's own memory, waits until lwIP is done with them.
+#define NSREQ_SENDFILE	13
+#define NSREQ_SENDPAGES	14
+
+// The reply to the following two messages passes back the request
+// page, updated
+#define NSREQ_IOCTL	15
+#define NSREQ_SELECT	16
+
+// The most data pages a request or a reply carries.  NSREQ_RECV
+// replies with the data received in as many pages as it takes.
+#define NSREQ_MAXDATA	16
 
 struct Nsreq_accept {
     int req_s;
@@ -73,6 +87,28 @@ struct Nsreq_send {
     char req_dataptr[0];
 };
 
+struct Nsreq_sendpages {
+    int req_s;
+    int req_offset;	// of the data in the first data page
+    int req_size;
+    unsigned int req_flags;
+};
+
+struct Nsreq_ioctl {
+    int req_s;
+    long req_cmd;	// FIONBIO or FIONREAD
+    uint32_t req_arg;	// in for FIONBIO, out for FIONREAD
+};
+
+struct Nsreq_select {
+    int req_nfds;
+    fd_set req_readset;
+    fd_set req_writeset;
+    fd_set req_exceptset;
+    bool req_hastimeout;	// wait forever if not set
+    struct timeval req_timeout;
+};
+
 struct Nsreq_socket {
     int req_domain;
     int req_type;
@@ -21,7 +21,20 @@ enum
 	SYS_time_msec,
 	SYS_net_txbuf,
 	SYS_net_rxbuf,
+	SYS_ipc_try_send_pages,
+	SYS_ipc_recv_pages,
+	SYS_net_txbufs,
+	SYS_net_rxbufs,
+	SYS_net_txfrags,
+	SYS_net_rxnotify,
+	SYS_ipc_recv_timed,
+	SYS_time_nsec,
+	SYS_time_sleep,
 	NSYSCALLS
 };
 
+// Or'ed into a fragment size passed to sys_net_txfrags, to have the
+// kernel copy the fragment instead of the device reading it in place.
+#define NETBUF_COPY	0x80000000
+
 #endif /* !JOS_INC_SYSCALL_H */
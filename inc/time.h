@@ -0,0 +1,36 @@
+#ifndef JOS_INC_TIME_H
+#define JOS_INC_TIME_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+// The kernel's clock, mapped read-only for users at UTIME so that
+// they can read the time without a system call.
+//
+// The TSC is calibrated against the 8253 at boot.  A TSC reading 'tsc'
+// is ((tsc - ti_tsc_base) << ti_tsc_shift) * ti_tsc_mult / 2^32
+// nanoseconds after boot; see tsc_to_nsec.  ti_tsc_mult is 0 if the
+// processor has no usable TSC, and then only ti_ticks keeps time.
+// The structure fills its page, so that mapping it shows users nothing
+// else of the kernel.
+struct Timeinfo {
+	volatile uint32_t ti_ticks;	// clock ticks since boot
+	uint32_t ti_tick_msec;		// milliseconds per tick
+	uint32_t ti_tsc_mult;
+	uint32_t ti_tsc_shift;
+	uint64_t ti_tsc_base;
+	uint64_t ti_tsc_hz;		// TSC frequency, for information
+	uint8_t ti_pad[PGSIZE - 4 * sizeof(uint32_t) - 2 * sizeof(uint64_t)];
+};
+
+static __inline uint64_t
+tsc_to_nsec(const volatile struct Timeinfo *ti, uint64_t tsc)
+{
+	uint64_t d = (tsc - ti->ti_tsc_base) << ti->ti_tsc_shift;
+	uint32_t m = ti->ti_tsc_mult;
+
+	// d * m / 2^32, without a 96-bit product
+	return (((d & 0xFFFFFFFF) * m) >> 32) + (d >> 32) * m;
+}
+
+#endif /* !JOS_INC_TIME_H */
@@ -37,6 +37,7 @@ static __inline uint32_t read_ebp(void) __attribute__((always_inline));
 static __inline uint32_t read_esp(void) __attribute__((always_inline));
 static __inline void cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp);
 static __inline uint64_t read_tsc(void) __attribute__((always_inline));
+static __inline uint32_t bsf(uint32_t word) __attribute__((always_inline));
 static __inline void wrmsr(uint32_t msr, uint32_t eax, uint32_t edx) __attribute__((always_inline));
 
 static __inline void
@@ -292,6 +293,16 @@ read_tsc(void)
         return tsc;
 }
 
+// Return the index of the least significant set bit in 'word'.
+// The result is undefined if 'word' is 0.
+static __inline uint32_t
+bsf(uint32_t word)
+{
+	uint32_t index;
+	__asm __volatile("bsfl %1,%0" : "=r" (index) : "rm" (word) : "cc");
+	return index;
+}
+
 static __inline void
 wrmsr(uint32_t msr, uint32_t eax, uint32_t edx)
 {
@@ -7,17 +7,21 @@
 #include <kern/pci.h>
 #include <kern/pmap.h>
 #include <kern/picirq.h>
+#include <kern/env.h>
+#include <kern/syscall.h>
 
 uint8_t e100_irq;
 
-#define E100_TX_SLOTS			64
-#define E100_RX_SLOTS			64
+#define E100_TX_SLOTS			E100_MAXBUFS
+#define E100_TX_COPYSIZE		2048	// room for a whole frame
+#define E100_RX_SLOTS			E100_MAXBUFS
 
 #define E100_NULL			0xffffffff
 #define E100_SIZE_MASK			0x3fff	// mask out status/control bits
 
 #define	E100_CSR_SCB_STATACK		0x01	// scb_statack (1 byte)
 #define	E100_CSR_SCB_COMMAND		0x02	// scb_command (1 byte)
+#define	E100_CSR_SCB_INTMASK		0x03	// scb_intmask (1 byte)
 #define	E100_CSR_SCB_GENERAL		0x04	// scb_general (4 bytes)
 #define	E100_CSR_PORT			0x08	// port (4 bytes)
 
@@ -29,6 +33,8 @@ uint8_t e100_irq;
 #define E100_SCB_COMMAND_RU_START	1
 #define E100_SCB_COMMAND_RU_RESUME	2
 
+#define E100_SCB_INTMASK_M		0x01	// mask all device interrupts
+
 #define E100_SCB_STATACK_RNR		0x10
 #define E100_SCB_STATACK_CNA		0x20
 #define E100_SCB_STATACK_FR		0x40
@@ -50,6 +56,14 @@ uint8_t e100_irq;
 #define E100_RFA_CONTROL_SF		0x0008	// simple/flexible memory mode
 #define E100_RFA_CONTROL_S		0x4000	// suspend after reception
 
+// Interrupt mitigation.  An interrupt that finds E100_POLL_ENTER or
+// more frames done masks the device's interrupts, and the rings are
+// drained by e100_poll, from the timer tick, until a poll finds fewer than E100_POLL_EXIT frames.
+#define E100_POLL_ENTER			8
+#define E100_POLL_EXIT			2
+
+// Histogram buckets of frames per interrupt: 0, 1, 2-3, 4-7, ..., 64+
+#define E100_HIST_BUCKETS		8
 
 struct e100_cb_tx {
 	volatile uint16_t cb_status;
@@ -91,10 +105,10 @@ struct e100_rbd {
 
 struct e100_tx_slot {
 	struct e100_cb_tx tcb;
-	struct e100_tbd tbd;
 	// Some cards require two TBD after the TCB ("Extended TCB")
-	struct e100_tbd unused;
-	struct Page *p;
+	struct e100_tbd tbd[E100_TX_MAXTBDS];
+	struct Page *p[E100_TX_MAXTBDS];	// pages tbd[] points into, or 0
+	char copybuf[E100_TX_COPYSIZE];		// fragments copied by e100_txfrags
 };
 
 struct e100_rx_slot {
@@ -116,8 +130,21 @@ static struct {
 	int rx_head;
 	int rx_tail;
 	char rx_idle;
+	envid_t rx_notify;	// environment notified through IPC, or 0
+	uint32_t rx_notify_value;
+
+	char polling;		// interrupts masked, rings drained by e100_poll
 } the_e100;
 
+static struct {
+	uint32_t intrs;		// device interrupts taken
+	uint32_t polls;		// calls to e100_poll in polling mode
+	uint32_t poll_enters;	// switches from interrupts to polling
+	uint32_t tx_frames;
+	uint32_t rx_frames;
+	uint32_t hist[E100_HIST_BUCKETS];	// interrupts by frames handled
+} e100_stats;
+
 // Each inb of port 0x84 takes about 1.25us
 static void udelay(unsigned int u)
 {
@@ -163,27 +190,110 @@ static void e100_tx_start(void)
 	}
 }
 
+// Fill in the next TCB; the caller starts the CU.  Only the last TCB
+// of a batch suspends the CU and interrupts on completion; the others
+// are reaped along with it.
+static void e100_tx_queue(struct Page *pp, unsigned int size, unsigned int offset,
+			  bool last)
+{
+	int i = the_e100.tx_head % E100_TX_SLOTS;
+
+	the_e100.tx[i].tbd[0].tb_addr = page2pa(pp) + offset;
+	the_e100.tx[i].tbd[0].tb_size = size & E100_SIZE_MASK;
+	the_e100.tx[i].tcb.tbd_number = 1;
+	the_e100.tx[i].tcb.cb_status = 0;
+	the_e100.tx[i].tcb.cb_command = E100_CB_COMMAND_XMIT | E100_CB_COMMAND_SF;
+	if (last)
+		the_e100.tx[i].tcb.cb_command |= E100_CB_COMMAND_I | E100_CB_COMMAND_S;
+
+	pp->pp_ref++;
+	the_e100.tx[i].p[0] = pp;
+	the_e100.tx_head++;
+}
+
 int e100_txbuf(struct Page *pp, unsigned int size, unsigned int offset)
+{
+	return e100_txbufs(&pp, &size, &offset, 1);
+}
+
+// Queue 'n' buffers for transmission, in order, and start the CU once
+// for all of them.  Either all are queued or, if the ring lacks room
+// for them, none are.
+int e100_txbufs(struct Page **pps, unsigned int *sizes, unsigned int *offsets, int n)
 {
 	int i;
 
-	if (the_e100.tx_head - the_e100.tx_tail == E100_TX_SLOTS) {
+	if (the_e100.tx_head - the_e100.tx_tail + n > E100_TX_SLOTS) {
 		cprintf("e100_txbuf: no space\n");
 		return -E_NO_MEM;
 	}
+	if (n <= 0)
+		return n < 0 ? -E_INVAL : 0;
 
-	i = the_e100.tx_head % E100_TX_SLOTS;
+	for (i = 0; i < n; i++)
+		e100_tx_queue(pps[i], sizes[i], offsets[i], i == n - 1);
+	e100_tx_start();
 
-	the_e100.tx[i].tbd.tb_addr = page2pa(pp) + offset;
-	the_e100.tx[i].tbd.tb_size = size & E100_SIZE_MASK;
-	the_e100.tx[i].tcb.cb_status = 0;
-	the_e100.tx[i].tcb.cb_command = E100_CB_COMMAND_XMIT |
-		E100_CB_COMMAND_SF | E100_CB_COMMAND_I | E100_CB_COMMAND_S;
+	return 0;
+}
 
-	pp->pp_ref++;
-	the_e100.tx[i].p = pp;
+// Queue one frame gathered from 'n' fragments, each within one page.
+// Fragment i is sent in place from offsets[i] in pps[i] or, if pps[i]
+// is null, copied now from vas[i], for data that may change before
+// the CU reads it.  Adjacent copied fragments share a TBD.
+// Returns -E_NO_MEM if the ring is full, and -E_INVAL if the frame
+// needs more than E100_TX_MAXTBDS TBDs or too much copying.
+int e100_txfrags(struct Page **pps, void **vas, unsigned int *sizes,
+		 unsigned int *offsets, int n)
+{
+	struct e100_tx_slot *slot;
+	unsigned int copied = 0;
+	int i, t, ntbd = 0;
+
+	if (the_e100.tx_head - the_e100.tx_tail == E100_TX_SLOTS)
+		return -E_NO_MEM;
+	if (n <= 0)
+		return -E_INVAL;
+
+	for (i = 0; i < n; i++) {
+		if (pps[i]) {
+			ntbd++;
+			continue;
+		}
+		if (i == 0 || pps[i - 1])
+			ntbd++;
+		copied += sizes[i];
+	}
+	if (ntbd > E100_TX_MAXTBDS || copied > E100_TX_COPYSIZE)
+		return -E_INVAL;
+
+	slot = &the_e100.tx[the_e100.tx_head % E100_TX_SLOTS];
+	copied = 0;
+	t = -1;
+	for (i = 0; i < n; i++) {
+		if (pps[i]) {
+			t++;
+			slot->tbd[t].tb_addr = page2pa(pps[i]) + offsets[i];
+			slot->tbd[t].tb_size = sizes[i] & E100_SIZE_MASK;
+			pps[i]->pp_ref++;
+			slot->p[t] = pps[i];
+			continue;
+		}
+		if (i == 0 || pps[i - 1]) {
+			t++;
+			slot->tbd[t].tb_addr = PADDR(slot->copybuf + copied);
+			slot->tbd[t].tb_size = 0;
+		}
+		memmove(slot->copybuf + copied, vas[i], sizes[i]);
+		copied += sizes[i];
+		slot->tbd[t].tb_size += sizes[i];
+	}
+	slot->tcb.tbd_number = ntbd;
+	slot->tcb.cb_status = 0;
+	slot->tcb.cb_command = E100_CB_COMMAND_XMIT | E100_CB_COMMAND_SF |
+		E100_CB_COMMAND_I | E100_CB_COMMAND_S;
 	the_e100.tx_head++;
-	
+
 	e100_tx_start();
 
 	return 0;
@@ -208,42 +318,62 @@ static void e100_rx_start(void)
 	}
 }
 
-int e100_rxbuf(struct Page *pp, unsigned int size, unsigned int offset)
+// Fill in the next RFD; the caller starts the RU.  Only the last RFD
+// of a batch suspends the RU.
+static void e100_rx_queue(struct Page *pp, unsigned int size, unsigned int offset,
+			  bool last)
 {
-	int i;
-
-	if (the_e100.rx_head - the_e100.rx_tail == E100_TX_SLOTS) {
-		cprintf("e100_rxbuf: no space\n");
-		return -E_NO_MEM;
-	}
-
-	if (size <= 4) {
-		cprintf("e100_rxbuf: weird size (%u)\n", size);
-		return -E_INVAL;
-	}
-
-	i = the_e100.rx_head % E100_TX_SLOTS;
+	int i = the_e100.rx_head % E100_RX_SLOTS;
 
 	// The first 4 bytes will hold the number of bytes recieved
 	the_e100.rx[i].rbd.rbd_buffer = page2pa(pp) + offset + 4;
 	the_e100.rx[i].rbd.rbd_size = (size - 4) & E100_SIZE_MASK;
 	the_e100.rx[i].rfd.rfa_status = 0;
-	the_e100.rx[i].rfd.rfa_control = 
-		E100_RFA_CONTROL_SF | E100_RFA_CONTROL_S;
+	the_e100.rx[i].rfd.rfa_control = E100_RFA_CONTROL_SF;
+	if (last)
+		the_e100.rx[i].rfd.rfa_control |= E100_RFA_CONTROL_S;
 
 	pp->pp_ref++;
 	the_e100.rx[i].p = pp;
 	the_e100.rx[i].offset = offset;
 	the_e100.rx_head++;
+}
+
+int e100_rxbuf(struct Page *pp, unsigned int size, unsigned int offset)
+{
+	return e100_rxbufs(&pp, &size, &offset, 1);
+}
+
+// Post 'n' receive buffers, in order, and start the RU once for all of
+// them.  Either all are posted or none are.
+int e100_rxbufs(struct Page **pps, unsigned int *sizes, unsigned int *offsets, int n)
+{
+	int i;
+
+	if (the_e100.rx_head - the_e100.rx_tail + n > E100_RX_SLOTS) {
+		cprintf("e100_rxbuf: no space\n");
+		return -E_NO_MEM;
+	}
+	if (n <= 0)
+		return n < 0 ? -E_INVAL : 0;
 
+	for (i = 0; i < n; i++)
+		if (sizes[i] <= 4) {
+			cprintf("e100_rxbuf: weird size (%u)\n", sizes[i]);
+			return -E_INVAL;
+		}
+
+	for (i = 0; i < n; i++)
+		e100_rx_queue(pps[i], sizes[i], offsets[i], i == n - 1);
 	e100_rx_start();
 
 	return 0;
 }
 
-static void e100_intr_tx(void)
+// Reap the TCBs the CU has finished.  Returns how many.
+static int e100_intr_tx(void)
 {
-	int i;
+	int i, j, n = 0;
 
 	for (; the_e100.tx_head != the_e100.tx_tail; the_e100.tx_tail++) {
 		i = the_e100.tx_tail % E100_TX_SLOTS;
@@ -251,15 +381,23 @@ static void e100_intr_tx(void)
 		if (!(the_e100.tx[i].tcb.cb_status & E100_CB_STATUS_C))
 			break;
 
-		page_decref(the_e100.tx[i].p);
-		the_e100.tx[i].p = 0;
+		for (j = 0; j < E100_TX_MAXTBDS; j++)
+			if (the_e100.tx[i].p[j]) {
+				page_decref(the_e100.tx[i].p[j]);
+				the_e100.tx[i].p[j] = 0;
+			}
+		n++;
 	}
+	e100_stats.tx_frames += n;
+	return n;
 }
 
-static void e100_intr_rx(void)
+// Complete the RFDs the RU has filled.  Returns how many.
+static int e100_intr_rx(void)
 {
 	int *count;
-	int i;
+	int i, n = 0;
+	struct Env *e;
 
 	for (; the_e100.rx_head != the_e100.rx_tail; the_e100.rx_tail++) {
 		i = the_e100.rx_tail % E100_RX_SLOTS;
@@ -276,35 +414,119 @@ static void e100_intr_rx(void)
 		page_decref(the_e100.rx[i].p);
 		the_e100.rx[i].p = 0;
 		the_e100.rx[i].offset = 0;
+		n++;
 	}
+
+	e100_stats.rx_frames += n;
+	if (n == 0)
+		return 0;
+	if (the_e100.rx_notify && envid2env(the_e100.rx_notify, &e, 0) == 0)
+		ipc_notify(e, the_e100.rx_notify_value);
+	return n;
 }
 
-void e100_intr(void)
+// Have 'e' told through IPC, with ipc_notify, when receive buffers
+// complete.
+int e100_rx_notify(struct Env *e, uint32_t value)
+{
+	the_e100.rx_notify = e->env_id;
+	the_e100.rx_notify_value = value;
+	return 0;
+}
+
+// Will 'e' be notified when receive buffers complete?
+bool e100_notifies(struct Env *e)
 {
-	int r;
+	return the_e100.rx_notify == e->env_id;
+}
+
+// Acknowledge the device's events, then reap both rings, whichever
+// events were raised.  Returns the number of frames done.
+static int e100_service(void)
+{
+	int r, n;
 	
 	r = inb(the_e100.iobase + E100_CSR_SCB_STATACK);
 	outb(the_e100.iobase + E100_CSR_SCB_STATACK, r);
 	
-	if (r & (E100_SCB_STATACK_CXTNO | E100_SCB_STATACK_CNA)) {
-		r &= ~(E100_SCB_STATACK_CXTNO | E100_SCB_STATACK_CNA);
-		e100_intr_tx();
-	}
-
-	if (r & E100_SCB_STATACK_FR) {
-		r &= ~E100_SCB_STATACK_FR;
-		e100_intr_rx();
-	}
+	n = e100_intr_tx() + e100_intr_rx();
+	r &= ~(E100_SCB_STATACK_CXTNO | E100_SCB_STATACK_CNA |
+	       E100_SCB_STATACK_FR);
 
 	if (r & E100_SCB_STATACK_RNR) {
 		r &= ~E100_SCB_STATACK_RNR;
 		the_e100.rx_idle = 1;
-		e100_rx_start();
-		cprintf("e100_intr: RNR interrupt, no RX bufs?\n");
+		if (the_e100.rx_tail != the_e100.rx_head)
+			e100_rx_start();
+		else
+			cprintf("e100_intr: RNR interrupt, no RX bufs?\n");
 	}
 
 	if (r)
 		cprintf("e100_intr: unhandled STAT/ACK %x\n", r);
+	return n;
+}
+
+static void e100_set_polling(bool polling)
+{
+	the_e100.polling = polling;
+	outb(the_e100.iobase + E100_CSR_SCB_INTMASK,
+	     polling ? E100_SCB_INTMASK_M : 0);
+}
+
+void e100_intr(void)
+{
+	int n, b;
+
+	n = e100_service();
+
+	e100_stats.intrs++;
+	for (b = 0; b < E100_HIST_BUCKETS - 1 && n >= (1 << b); b++)
+		;
+	e100_stats.hist[b]++;
+
+	if (n >= E100_POLL_ENTER && !the_e100.polling) {
+		e100_stats.poll_enters++;
+		e100_set_polling(1);
+	}
+}
+
+// Drain the rings while interrupts are masked.  Once the load drops,
+// unmask them; events that arrived since the last acknowledgement
+// then raise an interrupt at once.
+void e100_poll(void)
+{
+	if (!the_e100.polling)
+		return;
+	e100_stats.polls++;
+	if (e100_service() < E100_POLL_EXIT)
+		e100_set_polling(0);
+}
+
+// Is the driver counting on e100_poll being called every clock tick?
+bool e100_polling(void)
+{
+	return the_e100.polling;
+}
+
+void e100_print_stats(void)
+{
+	int b;
+
+	cprintf("e100: %u interrupts, %u polls, %u switches to polling%s\n",
+		e100_stats.intrs, e100_stats.polls, e100_stats.poll_enters,
+		the_e100.polling ? " (polling now)" : "");
+	cprintf("e100: %u frames sent, %u received\n",
+		e100_stats.tx_frames, e100_stats.rx_frames);
+	cprintf("e100: frames per interrupt:\n");
+	for (b = 0; b < E100_HIST_BUCKETS; b++)
+		if (b == 0)
+			cprintf("  %8s %u\n", "0", e100_stats.hist[b]);
+		else if (b == E100_HIST_BUCKETS - 1)
+			cprintf("  %6u + %u\n", 1 << (b - 1), e100_stats.hist[b]);
+		else
+			cprintf("  %4u-%-3u %u\n", 1 << (b - 1), (1 << b) - 1,
+				e100_stats.hist[b]);
 }
 
 void e100_init(struct pci_func *pcif)
@@ -335,7 +557,7 @@ void e100_init(struct pci_func *pcif)
 		next = (i + 1) % E100_TX_SLOTS;
 		memset(&the_e100.tx[i], 0, sizeof(the_e100.tx[i]));
 		the_e100.tx[i].tcb.link_addr = PADDR(&the_e100.tx[next].tcb);
-		the_e100.tx[i].tcb.tbd_array_addr = PADDR(&the_e100.tx[i].tbd);
+		the_e100.tx[i].tcb.tbd_array_addr = PADDR(&the_e100.tx[i].tbd[0]);
 		the_e100.tx[i].tcb.tbd_number = 1;
 		the_e100.tx[i].tcb.tx_threshold = 4;
 	}
@@ -6,12 +6,27 @@
 
 struct pci_func;
 struct Page;
+struct Env;
 
 int  e100_txbuf(struct Page *pp, unsigned int size, unsigned int offset);
 int  e100_rxbuf(struct Page *pp, unsigned int size, unsigned int offset);
+int  e100_txbufs(struct Page **pps, unsigned int *sizes, unsigned int *offsets, int n);
+int  e100_txfrags(struct Page **pps, void **vas, unsigned int *sizes,
+		  unsigned int *offsets, int n);
+int  e100_rxbufs(struct Page **pps, unsigned int *sizes, unsigned int *offsets, int n);
+int  e100_rx_notify(struct Env *e, uint32_t value);
+bool e100_notifies(struct Env *e);
 void e100_intr(void);
+void e100_poll(void);
+bool e100_polling(void);
+void e100_print_stats(void);
 void e100_init(struct pci_func *);
 
+// Most buffers one call can post; the size of each descriptor ring.
+#define E100_MAXBUFS	64
+// Most TBDs, and so fragments sent in place, in one frame.
+#define E100_TX_MAXTBDS	8
+
 extern uint8_t e100_irq;
 
 #endif	// JOS_KERN_E100_H
@@ -11,6 +11,7 @@
 #include <kern/pmap.h>
 #include <kern/trap.h>
 #include <kern/monitor.h>
+#include <kern/time.h>
 #include <kern/sched.h>
 
 struct Env *envs = NULL;		// All environments
@@ -188,6 +189,7 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	// Also clear the IPC receiving flag.
 	e->env_ipc_recving = 0;
+	e->env_ipc_notified = 0;
 
 	// If this is the file server (e == &envs[1]) give it I/O privileges.
 	if (e == &envs[1])
@@ -335,6 +337,8 @@ env_free(struct Env *e)
 	if (e == curenv)
 		lcr3(boot_cr3);
 
+	time_alarm_cancel(e);
+
 	// Note the environment's demise.
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
@@ -2,7 +2,8 @@
 
 /* Support for two time-related hardware gadgets: 1) the run time
  * clock with its NVRAM access functions; 2) the 8253 timer, which
- * generates interrupts on IRQ 0.
+ * generates interrupts on IRQ 0, and against whose counter 2 we
+ * calibrate the TSC.
  */
 
 #include <inc/x86.h>
@@ -33,11 +34,73 @@ void
 kclock_init(void)
 {
 	/* initialize 8253 clock to interrupt 100 times/sec */
-	outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
-	outb(IO_TIMER1, TIMER_DIV(100) % 256);
-	outb(IO_TIMER1, TIMER_DIV(100) / 256);
+	kclock_periodic();
 	cprintf("	Setup timer interrupts via 8259A\n");
 	irq_setmask_8259A(irq_mask_8259A & ~(1<<0));
 	cprintf("	unmasked timer interrupt\n");
 }
 
+
+// Have counter 0 interrupt 100 times a second.
+void
+kclock_periodic(void)
+{
+	outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
+	outb(IO_TIMER1, TIMER_DIV(100) % 256);
+	outb(IO_TIMER1, TIMER_DIV(100) / 256);
+}
+
+// Have counter 0 interrupt once, after 'count' periods of TIMER_FREQ,
+// and then stay quiet until kclock_periodic.  'count' must be less
+// than 65536.
+void
+kclock_oneshot(uint32_t count)
+{
+	outb(TIMER_MODE, TIMER_SEL0 | TIMER_INTTC | TIMER_16BIT);
+	outb(IO_TIMER1, count % 256);
+	outb(IO_TIMER1, count / 256);
+}
+
+// Read counter 0: the number of periods left in the current count.
+uint32_t
+kclock_read(void)
+{
+	uint32_t lo, hi;
+
+	outb(TIMER_MODE, TIMER_SEL0 | TIMER_LATCH);
+	lo = inb(IO_TIMER1);
+	hi = inb(IO_TIMER1);
+	return lo | (hi << 8);
+}
+
+// Calibrate the TSC over CALIBRATE_HZ-ths of a second of the 8253's
+// counter 2, which counts down once and then raises its output,
+// visible in bit 5 of the PPI port.  Counter 2 is otherwise the PC
+// speaker's, so the speaker is kept off.
+// Returns the TSC frequency in Hz, or 0 if the counter never ran out.
+#define CALIBRATE_HZ	20
+#define CALIBRATE_LOOPS	10000000
+
+uint64_t
+kclock_calibrate_tsc(void)
+{
+	uint64_t t0, t1;
+	uint8_t ppi;
+	int i;
+
+	ppi = inb(IO_PPI);
+	outb(IO_PPI, (ppi & ~0x02) | 0x01);	// gate on, speaker off
+	outb(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+	outb(TIMER_CNTR2, TIMER_DIV(CALIBRATE_HZ) % 256);
+	outb(TIMER_CNTR2, TIMER_DIV(CALIBRATE_HZ) / 256);
+
+	t0 = read_tsc();
+	for (i = 0; i < CALIBRATE_LOOPS && !(inb(IO_PPI) & 0x20); i++)
+		;
+	t1 = read_tsc();
+	outb(IO_PPI, ppi);
+
+	if (i == CALIBRATE_LOOPS)
+		return 0;
+	return (t1 - t0) * CALIBRATE_HZ;
+}
@@ -6,6 +6,8 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/types.h>
+
 #define	IO_RTC		0x070		/* RTC port */
 
 #define	MC_NVRAM_START	0xe	/* start of NVRAM: offset 14 */
@@ -29,5 +31,9 @@
 unsigned mc146818_read(unsigned reg);
 void mc146818_write(unsigned reg, unsigned datum);
 void kclock_init(void);
+void kclock_periodic(void);
+void kclock_oneshot(uint32_t count);
+uint32_t kclock_read(void);
+uint64_t kclock_calibrate_tsc(void);
 
 #endif	// !JOS_KERN_KCLOCK_H
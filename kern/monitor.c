@@ -12,6 +12,7 @@
 #include <kern/kdebug.h>
 #include <kern/pmap.h>
 #include <kern/trap.h>
+#include <kern/e100.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -33,6 +34,7 @@ static struct Command commands[] = {
 	{ "free_page", "Free an allocated page", mon_free_page },
 	{ "kdb", "Kernel debugger ('kdb help' for options)", mon_kdb },
 	{ "s", "Single step", mon_single_step },
+	{ "e100stats", "Display network interrupt and polling counters", mon_e100stats },
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
@@ -110,6 +112,13 @@ mon_single_step(int argc, char **argv, struct Trapframe *tf)
 	return -1;
 }
 
+int
+mon_e100stats(int argc, char **argv, struct Trapframe *tf)
+{
+	e100_print_stats();
+	return 0;
+}
+
 int
 mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 {
@@ -22,5 +22,6 @@ int mon_page_status(int argc, char **argv, struct Trapframe *tf);
 int mon_free_page(int argc, char **argv, struct Trapframe *tf);
 int mon_single_step(int argc, char **argv, struct Trapframe *tf);
 int mon_kdb(int argc, char **argv, struct Trapframe *tf);
+int mon_e100stats(int argc, char **argv, struct Trapframe *tf);
 
 #endif	// !JOS_KERN_MONITOR_H
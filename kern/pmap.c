@@ -8,6 +8,7 @@
 
 #include <kern/pmap.h>
 #include <kern/kclock.h>
+#include <kern/time.h>
 #include <kern/env.h>
 #include <kern/cpu.h>
 
@@ -193,6 +194,13 @@ i386_vm_init(void)
         boot_map_segment(boot_pgdir, UENVS, sizeof_envs, PADDR(envs), PTE_U);
         boot_map_segment(boot_pgdir, (uintptr_t) envs, sizeof_envs, PADDR(pages), PTE_W);
 
+	//////////////////////////////////////////////////////////////////////
+	// Map the kernel's clock read-only by the user at linear address UTIME
+	// (ie. perm = PTE_U | PTE_P), so users can read the time directly.
+	// It shares the envs slot, so envs must end before it.
+	static_assert(NENV * sizeof(struct Env) <= UTIME - UENVS);
+	boot_map_segment(boot_pgdir, UTIME, PGSIZE, PADDR(&timeinfo), PTE_U);
+
 	//////////////////////////////////////////////////////////////////////
         // Use the physical memory that bootstack refers to as
         // the kernel stack.  The complete VA
@@ -359,6 +367,9 @@ check_boot_pgdir(void)
 	for (i = 0; i < n; i += PGSIZE)
 		assert(check_va2pa(pgdir, UENVS + i) == PADDR(envs) + i);
 
+	// check clock page
+	assert(check_va2pa(pgdir, UTIME) == PADDR(&timeinfo));
+
 	// check phys mem
 	for (i = 0; i < npage * PGSIZE; i += PGSIZE)
 		assert(check_va2pa(pgdir, KERNBASE + i) == i);
@@ -696,6 +707,10 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm)
   pde_t *pgdir = env->env_pgdir;
   pte_t *pte;
 
+  // A range that wraps around the address space would check nothing.
+  if (end < user_mem_check_addr)
+    return -E_FAULT;
+
   for (; user_mem_check_addr < end; user_mem_check_addr += PGSIZE) {
     if (user_mem_check_addr >= ULIM)
       return -E_FAULT;
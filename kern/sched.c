@@ -1,9 +1,54 @@
 #include <inc/assert.h>
+#include <inc/x86.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/time.h>
+#include <kern/e100.h>
 
+// Wait for an interrupt with no environment running.  The interrupt
+// enters trap() from the kernel, which then calls sched_yield again.
+// The clock need not tick meanwhile, unless the e100 relies on it.
+static void __attribute__((noreturn))
+sched_halt(void)
+{
+	curenv = NULL;
+	lcr3(boot_cr3);
+	if (!e100_polling())
+		time_idle();
+
+	// Start over at the top of the kernel stack, as a trap would.
+	__asm __volatile("movl $0, %%ebp\n\t"
+			 "movl %0, %%esp\n\t"
+			 "sti\n"
+			 "1:\thlt\n\t"
+			 "jmp 1b"
+			 : : "r" (KSTACKTOP) : "memory");
+	while (1)
+		;
+}
+
+// Is 'e' the only environment, besides the idle one, that can run?
+static bool
+sched_alone(struct Env *e)
+{
+	int i;
+
+	for (i = 1; i < NENV; i++)
+		if (envs[i].env_status == ENV_RUNNABLE && &envs[i] != e)
+			return 0;
+	return 1;
+}
+
+// Can an interrupt make 'e' runnable: is it in a timed receive or
+// sleep, or waiting for a notification from the e100?
+static bool
+sched_wakeable(struct Env *e)
+{
+	return e->env_status == ENV_NOT_RUNNABLE
+		&& (e->env_alarm_tick || e100_notifies(e));
+}
 
 // Choose a user environment to run and run it.
 void
@@ -19,6 +64,7 @@ sched_yield(void)
 	// unless NOTHING else is runnable.
 
   uint32_t i, n = 0;
+  bool waiting = 0;
   if (curenv)
     i = curenv - envs + 1;
   else
@@ -26,15 +72,27 @@ sched_yield(void)
 
   for (; n < NENV - 1; n++) {
     if (envs[i].env_status == ENV_RUNNABLE) {
+      // Alone, it has no quantum to end, so the clock need only
+      // interrupt for the next timed receive.
+      if (!e100_polling() && sched_alone(&envs[i]))
+        time_idle();
       env_run(&envs[i]);
       return;
     }
+    if (sched_wakeable(&envs[i]))
+      waiting = 1;
     i++;
     if (i == NENV)
       i = 1;
   }
 
-	// Run the special idle environment when nothing else is runnable.
+	// Environments waiting for a timeout or a packet will be woken by
+	// an interrupt: halt the processor until then.  One waiting for a
+	// message only another environment could send never will be.
+	if (waiting)
+		sched_halt();
+
+	// Run the special idle environment when nothing else is left.
 	if (envs[0].env_status == ENV_RUNNABLE)
 		env_run(&envs[0]);
 	else {
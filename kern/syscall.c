@@ -117,6 +117,9 @@ sys_env_set_status(envid_t envid, int status)
   int ret = envid2env(envid, &e, 1);
   if (ret)
     return ret;
+  // making e runnable ends any sleep it is in
+  if (status == ENV_RUNNABLE && !e->env_ipc_recving)
+    time_alarm_cancel(e);
   e->env_status = status;
   return 0;
 }
@@ -357,32 +360,125 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
   else
     e->env_ipc_perm = 0;
   
+  e->env_ipc_npages = ret;
   e->env_ipc_recving = 0;
   e->env_ipc_from = curenv->env_id;
   e->env_ipc_value = value;
   e->env_status = ENV_RUNNABLE;
+  time_alarm_cancel(e);
   return ret;
 }
 
+// Like sys_ipc_try_send, but sends up to 'npages' pages at once:
+// srcvas[i], if < UTOP, is mapped at the receiver's dstva + i*PGSIZE,
+// for as many pages as the receiver asked for in sys_ipc_recv_pages.
+// Every page is checked before any is mapped.
+//
+// Returns the number of page slots transferred on success
+// (env_ipc_npages in the receiver), and < 0 on error, with the same
+// errors as sys_ipc_try_send.
+static int
+sys_ipc_try_send_pages(envid_t envid, uint32_t value, void **srcvas,
+		       size_t npages, unsigned perm)
+{
+  int r;
+  size_t i, n = 0;
+  struct Env *e;
+  pte_t *pte;
+
+  if (npages > ~(size_t)0 / sizeof(void*))
+    return -E_INVAL;
+  if ((r = envid2env(envid, &e, 0)))
+    return r;
+  if (!e->env_ipc_recving)
+    return -E_IPC_NOT_RECV;
+  if ((r = check_perm(perm)))
+    return r;
+
+  // Only the slots the receiver asked for are read; check just those.
+  if ((uintptr_t)e->env_ipc_dstva < UTOP)
+    n = MIN(npages, (size_t)e->env_ipc_npages);
+  if ((r = user_mem_check(curenv, srcvas, n * sizeof(void*), PTE_U)))
+    return r;
+  for (i = 0; i < n; i++) {
+    if ((uintptr_t)srcvas[i] >= UTOP)
+      continue;
+    if (PGOFF(srcvas[i]) || !page_lookup(curenv->env_pgdir, srcvas[i], &pte))
+      return -E_INVAL;
+    if ((perm & PTE_W) && !(*pte & PTE_W))
+      return -E_INVAL;
+  }
+  for (i = 0; i < n; i++)
+    if ((uintptr_t)srcvas[i] < UTOP
+        && (r = page_map(curenv, srcvas[i], e, e->env_ipc_dstva + i*PGSIZE, perm))) {
+      // Take back the pages already mapped.
+      while (i-- > 0)
+        if ((uintptr_t)srcvas[i] < UTOP)
+          page_remove(e->env_pgdir, e->env_ipc_dstva + i*PGSIZE);
+      return r;
+    }
+
+  e->env_ipc_perm = n ? perm : 0;
+  e->env_ipc_npages = n;
+  e->env_ipc_recving = 0;
+  e->env_ipc_from = curenv->env_id;
+  e->env_ipc_value = value;
+  e->env_status = ENV_RUNNABLE;
+  time_alarm_cancel(e);
+  return n;
+}
+
+// Send 'value' to 'e' from the kernel, as envid 0 with no page, the way
+// sys_ipc_try_send would.  Devices use this to tell an environment that
+// they need attention.  If 'e' is not receiving, the value is kept and
+// its next receive returns it at once; a later notification replaces
+// a kept one.
+void
+ipc_notify(struct Env *e, uint32_t value)
+{
+  if (!e->env_ipc_recving) {
+    e->env_ipc_notified = 1;
+    e->env_ipc_notify_value = value;
+    return;
+  }
+  e->env_ipc_recving = 0;
+  e->env_ipc_from = 0;
+  e->env_ipc_value = value;
+  e->env_ipc_perm = 0;
+  e->env_ipc_npages = 0;
+  e->env_status = ENV_RUNNABLE;
+  time_alarm_cancel(e);
+}
+
 // Block until a value is ready.  Record that you want to receive
 // using the env_ipc_recving and env_ipc_dstva fields of struct Env,
 // mark yourself not runnable, and then give up the CPU.
 //
-// If 'dstva' is < UTOP, then you are willing to receive a page of data.
-// 'dstva' is the virtual address at which the sent page should be mapped.
+// If 'dstva' is < UTOP, then you are willing to receive up to 'npages'
+// pages of data, mapped at consecutive addresses from 'dstva'
+// (see sys_ipc_try_send_pages).
 //
 // This function only returns on error, but the system call will eventually
 // return 0 on success.
 // Return < 0 on error.  Errors are:
-//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned,
+//		or the range does not fit below UTOP.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv_pages(void *dstva, size_t npages)
 {
-  if ((uintptr_t)dstva < UTOP && (PGOFF(dstva)))
+  if ((uintptr_t)dstva < UTOP
+      && (PGOFF(dstva) || npages == 0 || npages > (UTOP - (uintptr_t)dstva) / PGSIZE))
     return -E_INVAL;
 
   curenv->env_ipc_dstva = dstva;
+  curenv->env_ipc_npages = npages;
   curenv->env_ipc_recving = 1;
+  // A notification sent while we were not receiving
+  if (curenv->env_ipc_notified) {
+    curenv->env_ipc_notified = 0;
+    ipc_notify(curenv, curenv->env_ipc_notify_value);
+    return 0;
+  }
   /* Just set the status, do NOT call sched_yield(): trap() does it for us.
      As soon as we call sched_yield(), other processes take control, and
      when we are ready to run again, we start directly in user space using
@@ -392,6 +488,30 @@ sys_ipc_recv(void *dstva)
   return 0;
 }
 
+// Like sys_ipc_recv_pages, but give up at time 'msec' (as returned by
+// sys_time_msec), when the system call returns -E_TIMEOUT.  An 'msec'
+// of ~0 never times out.  The timeout is measured in clock ticks, and
+// the environment stays blocked until then.
+static int
+sys_ipc_recv_timed(void *dstva, size_t npages, unsigned int msec)
+{
+  int r;
+
+  if ((uintptr_t)dstva < UTOP
+      && (PGOFF(dstva) || npages == 0 || npages > (UTOP - (uintptr_t)dstva) / PGSIZE))
+    return -E_INVAL;
+  if (msec != ~0U && (r = time_alarm(curenv, msec)) < 0)
+    return r;
+  return sys_ipc_recv_pages(dstva, npages);
+}
+
+// Receive at most one page at 'dstva'.
+static int
+sys_ipc_recv(void *dstva)
+{
+  return sys_ipc_recv_pages(dstva, 1);
+}
+
 // Return the current time.
 static int
 sys_time_msec(void) 
@@ -399,39 +519,138 @@ sys_time_msec(void)
   return time_msec();
 }
 
+// Store the time since boot, in nanoseconds, in *nsec.
+// Users can usually read it faster from the page at UTIME; see
+// time_nsec in lib/time.c.
 static int
-sys_net_buf(void *bufva, unsigned int size, int rx)
+sys_time_nsec(uint64_t *nsec)
+{
+  user_mem_assert(curenv, nsec, sizeof(*nsec), PTE_U|PTE_W);
+  *nsec = time_nsec();
+  return 0;
+}
+
+// Block until time 'msec' (as returned by sys_time_msec), without
+// receiving: unlike a timed receive, no message ends the wait.
+// Returns 0, at once if 'msec' has passed.
+static int
+sys_time_sleep(unsigned int msec)
+{
+  if (time_alarm(curenv, msec) < 0)
+    return 0;
+  curenv->env_status = ENV_NOT_RUNNABLE;
+  return 0;
+}
+
+// Check that [bufva, bufva+size) is a buffer in one page of curenv
+// that the device may read (or, if 'rx', write), and find that page.
+static int
+net_buf_lookup(void *bufva, unsigned int size, int rx,
+	       struct Page **pp_store, unsigned int *offset_store)
 {
 	unsigned int offset;
 	struct Page *pp;
 	int r, perm;
 
-	perm = PTE_U | rx ? PTE_W : 0;
+	perm = PTE_U | (rx ? PTE_W : 0);
 	if ((r = user_mem_check(curenv, bufva, size, perm))) {
-		cprintf("[%08x] user_mem_check failed %08x in sys_net_txbuf\n", 
+		cprintf("[%08x] user_mem_check failed %08x in sys_net_buf\n", 
 			curenv->env_id, bufva);
 		return r;
 	}
 
 	offset = (unsigned int) bufva % PGSIZE;
 	if (offset + size > PGSIZE) {
-		cprintf("[%08x] page overlap %x in sys_net_txbuf\n", 
+		cprintf("[%08x] page overlap %x in sys_net_buf\n", 
 			curenv->env_id, offset + size);
-		return r;
+		return -E_INVAL;
 	}
 
 	pp = page_lookup(curenv->env_pgdir, bufva, 0);
 	if (pp == 0) {
-		cprintf("[%08x] page_lookup failed %08x in sys_net_txbuf\n", 
+		cprintf("[%08x] page_lookup failed %08x in sys_net_buf\n", 
 			curenv->env_id, bufva);
 		return -E_INVAL;
 	}	
 
+	*pp_store = pp;
+	*offset_store = offset;
+	return 0;
+}
+
+static int
+sys_net_buf(void *bufva, unsigned int size, int rx)
+{
+	unsigned int offset;
+	struct Page *pp;
+	int r;
+
+	if ((r = net_buf_lookup(bufva, size, rx, &pp, &offset)) < 0)
+		return r;
 	if (rx)
 		return e100_rxbuf(pp, size, offset);
 	return e100_txbuf(pp, size, offset);
 }
 
+// Hand 'n' buffers to the device at once: bufs[i] holds sizes[i] bytes.
+// The device is kicked once for the whole batch, which is posted in
+// order.  Either every buffer is posted or, on error, none is.
+// Errors are those of sys_net_buf, and -E_INVAL if n > E100_MAXBUFS.
+static int
+sys_net_bufs(void **bufs, unsigned int *sizes, int n, int rx)
+{
+	struct Page *pps[E100_MAXBUFS];
+	unsigned int psizes[E100_MAXBUFS], offsets[E100_MAXBUFS];
+	int i, r;
+
+	if (n < 0 || n > E100_MAXBUFS)
+		return -E_INVAL;
+	user_mem_assert(curenv, bufs, n * sizeof(bufs[0]), PTE_U);
+	user_mem_assert(curenv, sizes, n * sizeof(sizes[0]), PTE_U);
+
+	for (i = 0; i < n; i++) {
+		psizes[i] = sizes[i];
+		if ((r = net_buf_lookup(bufs[i], psizes[i], rx,
+					&pps[i], &offsets[i])) < 0)
+			return r;
+	}
+	if (rx)
+		return e100_rxbufs(pps, psizes, offsets, n);
+	return e100_txbufs(pps, psizes, offsets, n);
+}
+
+// Transmit one frame gathered from 'n' fragments: bufs[i] holds
+// sizes[i] bytes, within one page.  The device reads a fragment in
+// place unless NETBUF_COPY is or'ed into its size, in which case the
+// kernel copies it now and the caller may reuse the memory at once.
+// Returns 0 on success, < 0 on error.  Errors are those of
+// sys_net_buf, and -E_INVAL if n > E100_MAXBUFS or the frame has too
+// many fragments sent in place.
+static int
+sys_net_txfrags(void **bufs, unsigned int *sizes, int n)
+{
+	struct Page *pps[E100_MAXBUFS];
+	void *vas[E100_MAXBUFS];
+	unsigned int psizes[E100_MAXBUFS], offsets[E100_MAXBUFS];
+	int i, r;
+
+	if (n < 0 || n > E100_MAXBUFS)
+		return -E_INVAL;
+	user_mem_assert(curenv, bufs, n * sizeof(bufs[0]), PTE_U);
+	user_mem_assert(curenv, sizes, n * sizeof(sizes[0]), PTE_U);
+
+	for (i = 0; i < n; i++) {
+		vas[i] = bufs[i];
+		psizes[i] = sizes[i] & ~NETBUF_COPY;
+		if ((r = net_buf_lookup(vas[i], psizes[i], 0,
+					&pps[i], &offsets[i])) < 0)
+			return r;
+		if (sizes[i] & NETBUF_COPY)
+			pps[i] = 0;
+	}
+	return e100_txfrags(pps, vas, psizes, offsets, n);
+}
+
 // Dispatches to the correct kernel function, passing the arguments.
 int32_t
 syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
@@ -464,14 +683,32 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
     return sys_ipc_try_send(a1, a2, (void *)a3, a4);
   case SYS_ipc_recv:
     return sys_ipc_recv((void *)a1);
+  case SYS_ipc_try_send_pages:
+    return sys_ipc_try_send_pages(a1, a2, (void **)a3, a4, a5);
+  case SYS_ipc_recv_pages:
+    return sys_ipc_recv_pages((void *)a1, a2);
+  case SYS_ipc_recv_timed:
+    return sys_ipc_recv_timed((void *)a1, a2, a3);
   case SYS_env_set_trapframe:
     return sys_env_set_trapframe(a1, (void *)a2);
   case SYS_time_msec:
     return sys_time_msec();
+  case SYS_time_nsec:
+    return sys_time_nsec((uint64_t *) a1);
+  case SYS_time_sleep:
+    return sys_time_sleep(a1);
   case SYS_net_txbuf:
     return sys_net_buf((void *)a1, a2, 0);
   case SYS_net_rxbuf:
     return sys_net_buf((void *)a1, a2, 1);
+  case SYS_net_txbufs:
+    return sys_net_bufs((void **)a1, (unsigned int *)a2, a3, 0);
+  case SYS_net_rxbufs:
+    return sys_net_bufs((void **)a1, (unsigned int *)a2, a3, 1);
+  case SYS_net_txfrags:
+    return sys_net_txfrags((void **)a1, (unsigned int *)a2, a3);
+  case SYS_net_rxnotify:
+    return e100_rx_notify(curenv, a1);
   default:
     return -E_INVAL;
   }
@@ -5,7 +5,9 @@
 #endif
 
 #include <inc/syscall.h>
+#include <inc/env.h>
 
 int32_t syscall(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5);
+void ipc_notify(struct Env *e, uint32_t value);
 
 #endif /* !JOS_KERN_SYSCALL_H */
@@ -1,26 +1,227 @@
 #include <kern/time.h>
+#include <kern/env.h>
+#include <kern/kclock.h>
+#include <inc/x86.h>
+#include <inc/timerreg.h>
+#include <inc/stdio.h>
 #include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/queue.h>
 
-static unsigned int ticks;
+// The clock, mapped read-only at UTIME for users.
+struct Timeinfo timeinfo __attribute__ ((aligned(PGSIZE)));
+
+// Environments in timed receives or sleeps hang off the timer wheel, in
+// the slot for the tick their wait ends modulo WHEEL_SLOTS, so each tick
+// looks only at the environments that may be due.
+#define WHEEL_SLOTS	64
+
+static LIST_HEAD(Alarm_list, Env) wheel[WHEEL_SLOTS];
+
+// Set up timeinfo to convert TSC readings to nanoseconds, if the
+// processor has a TSC and it can be calibrated.
+static void
+time_tsc_init(void)
+{
+	uint32_t edx, shift;
+	uint64_t hz;
+
+	cpuid(1, 0, 0, 0, &edx);
+	if (!(edx & (1 << 4)) || (hz = kclock_calibrate_tsc()) == 0) {
+		cprintf("	no usable TSC; time has 10ms resolution\n");
+		return;
+	}
+
+	// Scale the frequency above 1GHz so that the multiplier,
+	// nanoseconds per scaled cycle times 2^32, fits in 32 bits.
+	for (shift = 0; (hz << shift) <= 1000000000; shift++)
+		;
+	timeinfo.ti_tsc_hz = hz;
+	timeinfo.ti_tsc_shift = shift;
+	timeinfo.ti_tsc_mult = (1000000000ULL << 32) / (hz << shift);
+	timeinfo.ti_tsc_base = read_tsc();
+	cprintf("	TSC runs at %u kHz\n", (uint32_t) (hz / 1000));
+}
 
 void
 time_init(void) 
 {
-	ticks = 0;
+	int i;
+
+	static_assert(sizeof(timeinfo) == PGSIZE);
+	timeinfo.ti_ticks = 0;
+	timeinfo.ti_tick_msec = 10;
+	for (i = 0; i < WHEEL_SLOTS; i++)
+		LIST_INIT(&wheel[i]);
+	time_tsc_init();
+}
+
+// End e's receive with -E_TIMEOUT, or end its sleep.
+static void
+time_alarm_fire(struct Env *e)
+{
+	e->env_alarm_tick = 0;
+	if (e->env_ipc_recving) {
+		e->env_ipc_recving = 0;
+		e->env_tf.tf_regs.reg_eax = -E_TIMEOUT;
+	}
+	e->env_status = ENV_RUNNABLE;
+}
+
+// Move the clock on 'n' ticks, timing out receives as they come due.
+static void
+time_advance(unsigned int n)
+{
+	struct Env *e, *next;
+	unsigned int ticks;
+
+	while (n-- > 0) {
+		ticks = ++timeinfo.ti_ticks;
+		if (ticks * 10 < ticks)
+			panic("time_tick: time overflowed");
+
+		for (e = LIST_FIRST(&wheel[ticks % WHEEL_SLOTS]); e; e = next) {
+			next = LIST_NEXT(e, env_alarm_link);
+			if (e->env_alarm_tick <= ticks) {
+				LIST_REMOVE(e, env_alarm_link);
+				time_alarm_fire(e);
+			}
+		}
+	}
 }
 
-// this is called once per timer interupt; a timer interupt fires 100 times a
-// second
+// While the processor idles, or runs a single environment that has no
+// quantum to end, the 8253 need not interrupt every tick.
+// time_idle programs it to interrupt once, at the first tick on which
+// a receive times out, or IDLE_MAXTICKS ticks away, whichever comes
+// first; IDLE_MAXTICKS ticks are about all its 16-bit counter holds.
+// The one-shot count ends on a tick boundary, so the tick keeps its
+// phase.  oneshot_ticks is the number of ticks the count stands for,
+// or 0 while the clock is periodic.
+#define TICK_COUNT	TIMER_DIV(100)
+#define IDLE_MAXTICKS	5
+#define IDLE_MINCOUNT	(TICK_COUNT / 8)
+
+static unsigned int oneshot_ticks;
+static uint32_t oneshot_count;
+
+// This is called once per timer interrupt.  The timer interrupts 100
+// times a second, except while the processor idles.
 void
 time_tick(void) 
 {
-	ticks++;
-	if (ticks * 10 < ticks)
-		panic("time_tick: time overflowed");
+	unsigned int n = 1;
+
+	if (oneshot_ticks) {
+		n = oneshot_ticks;
+		oneshot_ticks = 0;
+		kclock_periodic();
+	}
+	time_advance(n);
+}
+
+// Return how many ticks from now the first receive or sleep ends,
+// but at most 'max'.
+static unsigned int
+time_next_alarm(unsigned int max)
+{
+	struct Env *e;
+	unsigned int n, tick;
+
+	for (n = 1; n < max; n++) {
+		tick = timeinfo.ti_ticks + n;
+		LIST_FOREACH(e, &wheel[tick % WHEEL_SLOTS], env_alarm_link)
+			if (e->env_alarm_tick == tick)
+				return n;
+	}
+	return max;
+}
+
+// Stop the periodic tick before halting an idle processor or running
+// the only runnable environment.  Any trap catches the clock up again,
+// through time_wake, and brings the tick back at the next boundary.
+void
+time_idle(void)
+{
+	unsigned int n;
+	uint32_t count;
+
+	if (oneshot_ticks)
+		return;
+
+	n = time_next_alarm(IDLE_MAXTICKS);
+	// Counts left until the next tick.  Too close to it, and that
+	// tick's interrupt may already be on its way.
+	count = kclock_read();
+	if (n == 1 || count < IDLE_MINCOUNT || count > TICK_COUNT)
+		return;
+
+	oneshot_count = count + (n - 1) * TICK_COUNT;
+	oneshot_ticks = n;
+	kclock_oneshot(oneshot_count);
+}
+
+// Catch the clock up after an interrupt other than the timer's, or a
+// system call, came in while the tick was stopped, and have the timer
+// interrupt again at the next tick, when time_tick makes it periodic
+// again.
+void
+time_wake(void)
+{
+	uint32_t count, left;
+
+	if (oneshot_ticks <= 1)
+		return;
+
+	// If the count has already run out, its interrupt is pending.
+	count = kclock_read();
+	if (count == 0 || count > oneshot_count)
+		return;
+
+	// Ticks still ahead are at count 0, TICK_COUNT, 2*TICK_COUNT...
+	left = (count + TICK_COUNT - 1) / TICK_COUNT;
+	time_advance(oneshot_ticks - left);
+	oneshot_count = count - (left - 1) * TICK_COUNT;
+	oneshot_ticks = 1;
+	if (left > 1)
+		kclock_oneshot(oneshot_count);
 }
 
 unsigned int
 time_msec(void) 
 {
-	return ticks * 10;
+	return timeinfo.ti_ticks * 10;
+}
+
+// Nanoseconds since boot, from the TSC if there is one.
+uint64_t
+time_nsec(void)
+{
+	if (!timeinfo.ti_tsc_mult)
+		return (uint64_t) timeinfo.ti_ticks * 10000000;
+	return tsc_to_nsec(&timeinfo, read_tsc());
+}
+
+// Time out e's next receive, or end its sleep, at 'msec', as returned
+// by time_msec, rounded up to a tick.  Returns -E_TIMEOUT if that time has passed.
+int
+time_alarm(struct Env *e, unsigned int msec)
+{
+	unsigned int tick = msec / 10 + (msec % 10 != 0);
+
+	time_alarm_cancel(e);
+	if (tick <= timeinfo.ti_ticks)
+		return -E_TIMEOUT;
+	e->env_alarm_tick = tick;
+	LIST_INSERT_HEAD(&wheel[tick % WHEEL_SLOTS], e, env_alarm_link);
+	return 0;
+}
+
+void
+time_alarm_cancel(struct Env *e)
+{
+	if (e->env_alarm_tick) {
+		LIST_REMOVE(e, env_alarm_link);
+		e->env_alarm_tick = 0;
+	}
 }
@@ -4,8 +4,19 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/time.h>
+
+extern struct Timeinfo timeinfo;
+
 void time_init(void);
 void time_tick(void); 
+void time_idle(void);
+void time_wake(void);
 unsigned int time_msec(void);
+uint64_t time_nsec(void);
+
+struct Env;
+int time_alarm(struct Env *e, unsigned int msec);
+void time_alarm_cancel(struct Env *e);
 
 #endif /* JOS_KERN_TIME_H */
@@ -164,6 +164,7 @@ trap_dispatch(struct Trapframe *tf)
   case IRQ_OFFSET + IRQ_TIMER:
   //// Lab 6: Add time tick increment to clock interrupts.
     time_tick();
+    e100_poll();
     sched_yield();
     return;
 
@@ -230,6 +231,12 @@ trap(struct Trapframe *tf)
 		tf = &curenv->env_tf;
 	}
 	
+	// An interrupt may have woken the processor from an idle halt
+	// with the clock stopped; catch it up.  The timer's own
+	// interrupt does that in time_tick.
+	if (tf->tf_trapno != IRQ_OFFSET + IRQ_TIMER)
+		time_wake();
+
 	// Dispatch based on what type of trap occurred
 	trap_dispatch(tf);
 
@@ -88,6 +88,16 @@ fd_lookup(int fdnum, struct Fd **fd_store)
 	return 0;
 }
 
+// Find the open file descriptor whose data area holds 'va'.
+// Returns 0 on success, < 0 (-E_INVAL) if there is none.
+int
+fd_data_lookup(void *va, struct Fd **fd_store)
+{
+	if ((uintptr_t) va < FILEBASE || (uintptr_t) va >= (uintptr_t) INDEX2DATA(MAXFD))
+		return -E_INVAL;
+	return fd_lookup(((uintptr_t) va - FILEBASE) / PTSIZE, fd_store);
+}
+
 // Frees file descriptor 'fd' by closing the corresponding file
 // and unmapping the file descriptor page.
 // If 'must_exist' is 0, then fd can be a closed or nonexistent file
@@ -4,6 +4,17 @@
 
 #define debug 0
 
+// Only the first FMAPSIZE bytes of an open file are mapped at
+// fd2data(fd); the rest is reached through a window of FILETEMPPAGES
+// pages at FILETEMP.
+#define FMAPSIZE	PTSIZE
+#define FILETEMPPAGES	16
+#define FILETEMP	((char*) (PFTEMP - FILETEMPPAGES * PGSIZE))
+
+// The mapping is filled in lazily: a fault in it maps the faulting page
+// and up to FAULTAROUND-1 unmapped pages after it, in one request.
+#define FAULTAROUND	16
+
 static int file_close(struct Fd *fd);
 static ssize_t file_read(struct Fd *fd, void *buf, size_t n, off_t offset);
 static ssize_t file_write(struct Fd *fd, const void *buf, size_t n, off_t offset);
@@ -22,8 +33,11 @@ struct Dev devfile =
 };
 
 // Helper functions for file access
-static int fmap(struct Fd *fd, off_t oldsize, off_t newsize);
-static int funmap(struct Fd *fd, off_t oldsize, off_t newsize, bool dirty);
+static bool page_is_mapped(void *va);
+static void file_fault_init(void);
+static int file_fault_in(struct Fd *fd, off_t offset);
+static void funmap(struct Fd *fd, off_t oldsize, off_t newsize, bool dirty);
+static int file_copy_far(struct Fd *fd, void *buf, size_t n, off_t offset, bool write);
 
 // Open a file (or directory),
 // returning the file descriptor index on success, < 0 on failure.
@@ -42,9 +56,8 @@ open(const char *path, int mode)
 	// at fsipc.c if you aren't sure.)
   if ((r = fsipc_open(path, mode, fd)))
     goto err;
-	// Then map the file data (you may find fmap() helpful).
-  if ((r = fmap(fd, 0, fd->fd_file.file.f_size)))
-    goto err;
+	// The file data is mapped on demand, as it is touched.
+  file_fault_init();
 	// Return the file descriptor index.
   return fd2num(fd);
 	// If any step fails, use fd_close to free the file descriptor.
@@ -59,11 +72,11 @@ static int
 file_close(struct Fd *fd)
 {
 	// Unmap any data mapped for the file,
-  int r1 = funmap(fd, fd->fd_file.file.f_size, 0, 1);
+  funmap(fd, fd->fd_file.file.f_size, 0, 1);
 	// then tell the file server that we have closed the file
-	// (to free up its resources).
-  int r2 = fsipc_close(fd->fd_file.id);
-  return (r1 || r2);
+	// (to free up its resources), all in one round trip.
+  fsring_close(fd->fd_file.id);
+  return fsring_enter();
 }
 
 // Read 'n' bytes from 'fd' at the current seek position into 'buf'.
@@ -72,7 +85,8 @@ file_close(struct Fd *fd)
 static ssize_t
 file_read(struct Fd *fd, void *buf, size_t n, off_t offset)
 {
-	size_t size;
+	int r;
+	size_t size, m;
 
 	// avoid reading past the end of file
 	size = fd->fd_file.file.f_size;
@@ -82,7 +96,14 @@ file_read(struct Fd *fd, void *buf, size_t n, off_t offset)
 		n = size - offset;
 
 	// read the data by copying from the file mapping
-	memmove(buf, fd2data(fd) + offset, n);
+	file_fault_init();
+	m = 0;
+	if (offset < FMAPSIZE) {
+		m = MIN(n, (size_t) (FMAPSIZE - offset));
+		memmove(buf, fd2data(fd) + offset, m);
+	}
+	if (m < n && (r = file_copy_far(fd, buf + m, n - m, offset + m, 0)) < 0)
+		return r;
 	return n;
 }
 
@@ -100,9 +121,9 @@ read_map(int fdnum, off_t offset, void **blk)
 	if (fd->fd_dev_id != devfile.dev_id)
 		return -E_INVAL;
 	va = fd2data(fd) + offset;
-	if (offset >= MAXFILESIZE)
+	if (offset >= FMAPSIZE)
 		return -E_NO_DISK;
-	if (!(vpd[PDX(va)] & PTE_P) || !(vpt[VPN(va)] & PTE_P))
+	if (!page_is_mapped(va) && file_fault_in(fd, offset) < 0)
 		return -E_NO_DISK;
 	*blk = (void*) va;
 	return 0;
@@ -113,7 +134,7 @@ static ssize_t
 file_write(struct Fd *fd, const void *buf, size_t n, off_t offset)
 {
 	int r;
-	size_t tot;
+	size_t tot, m;
 
 	// don't write past the maximum file size
 	tot = offset + n;
@@ -127,10 +148,58 @@ file_write(struct Fd *fd, const void *buf, size_t n, off_t offset)
 	}
 
 	// write the data
-	memmove(fd2data(fd) + offset, buf, n);
+	file_fault_init();
+	m = 0;
+	if (offset < FMAPSIZE) {
+		m = MIN(n, (size_t) (FMAPSIZE - offset));
+		memmove(fd2data(fd) + offset, buf, m);
+	}
+	if (m < n && (r = file_copy_far(fd, (void*) buf + m, n - m, offset + m, 1)) < 0)
+		return r;
 	return n;
 }
 
+// Copy 'n' bytes between 'buf' and the file at 'offset', which lies
+// beyond the permanent mapping.  Up to FILETEMPPAGES pages at a time
+// are borrowed from the file server at FILETEMP, in one request, and
+// handed back at the end.  The pages we wrote to are reported dirty
+// together at the end.
+static int
+file_copy_far(struct Fd *fd, void *buf, size_t n, off_t offset, bool write)
+{
+	int r = 0, i, npages, maxpages = 0;
+	size_t m;
+	off_t pgoff;
+
+	while (n > 0) {
+		pgoff = offset % PGSIZE;
+		npages = MIN(ROUNDUP(pgoff + n, PGSIZE) / PGSIZE, FILETEMPPAGES);
+		if ((r = fsipc_map_range(fd->fd_file.id, offset - pgoff, FILETEMP, npages)) <= 0) {
+			if (r == 0)
+				r = -E_INVAL;
+			break;
+		}
+		npages = r;
+		maxpages = MAX(maxpages, npages);
+		m = MIN(n, (size_t) (npages * PGSIZE - pgoff));
+		if (write) {
+			memmove(FILETEMP + pgoff, buf, m);
+			for (i = 0; i < npages; i++)
+				fsring_dirty(fd->fd_file.id, offset - pgoff + i * PGSIZE);
+		} else
+			memmove(buf, FILETEMP + pgoff, m);
+		buf += m;
+		offset += m;
+		n -= m;
+		r = 0;
+	}
+	for (i = 0; i < maxpages; i++)
+		sys_page_unmap(0, FILETEMP + i * PGSIZE);
+	if (write)
+		r = MIN(r, fsring_enter());
+	return r;
+}
+
 static int
 file_stat(struct Fd *fd, struct Stat *st)
 {
@@ -157,61 +226,109 @@ file_trunc(struct Fd *fd, off_t newsize)
 		return r;
 	assert(fd->fd_file.file.f_size == newsize);
 
-	if ((r = fmap(fd, oldsize, newsize)) < 0)
-		return r;
 	funmap(fd, oldsize, newsize, 0);
 
 	return 0;
 }
 
-// Call the file system server to obtain and map file pages
-// when the size of the file as mapped in our memory increases.
-// Harmlessly does nothing if oldsize >= newsize.
+// Extend an open file to 'newsize' bytes, asking the file server to
+// reserve all of its blocks now, contiguously where possible.
+// Does nothing if the file is already at least that large.
+int
+fallocate(int fdnum, off_t newsize)
+{
+	int r;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id
+	    || (fd->fd_omode & O_ACCMODE) == O_RDONLY)
+		return -E_INVAL;
+	if (newsize > MAXFILESIZE)
+		return -E_INVAL;
+
+	return fsipc_allocate(fd->fd_file.id, newsize);
+}
+
+static bool
+page_is_mapped(void *va)
+{
+	return (vpd[PDX(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P);
+}
+
+// Map the page of 'fd' holding 'offset', and the unmapped pages
+// that follow it, up to FAULTAROUND in all, with one request.
 // Returns 0 on success, < 0 on error.
-// If there is an error, unmaps any newly allocated pages.
 static int
-fmap(struct Fd* fd, off_t oldsize, off_t newsize)
+file_fault_in(struct Fd *fd, off_t offset)
 {
-  uint32_t fileid = fd->fd_file.id;
-  off_t off = ROUNDUP(oldsize, PGSIZE);
-  char *va = fd2data(fd);
-  int r;
-  
-  for (; off < newsize; off+=PGSIZE) {
-    r = fsipc_map(fileid, off, va+off);
-    if (r) {
-      funmap(fd, off, oldsize, 0);
-      return r;
-    }
-  }
-  return 0;
+	int r, n;
+	off_t end;
+	char *va;
+
+	offset = ROUNDDOWN(offset, PGSIZE);
+	end = MIN(ROUNDUP(fd->fd_file.file.f_size, PGSIZE), (off_t) FMAPSIZE);
+	if (offset < 0 || offset >= end)
+		return -E_INVAL;
+
+	va = fd2data(fd) + offset;
+	for (n = 1; n < FAULTAROUND && offset + n*PGSIZE < end
+		     && !page_is_mapped(va + n*PGSIZE); n++)
+		;
+	if ((r = fsipc_map_range(fd->fd_file.id, offset, va, n)) < 0)
+		return r;
+	return r > 0 ? 0 : -E_INVAL;
+}
+
+// Resolve faults on unmapped pages in the data area of an open file.
+static int
+file_pgfault(struct UTrapframe *utf)
+{
+	struct Fd *fd;
+	void *va = (void*) utf->utf_fault_va;
+
+	if (fd_data_lookup(va, &fd) < 0 || fd->fd_dev_id != devfile.dev_id
+	    || page_is_mapped(va))
+		return -E_INVAL;
+	return file_fault_in(fd, va - (void*) fd2data(fd));
+}
+
+// Make sure file_pgfault is installed.  Open files can be inherited,
+// so every path that touches the mapping calls this, not just open.
+static void
+file_fault_init(void)
+{
+	static bool done;
+
+	if (!done) {
+		add_pgfault_handler(file_pgfault);
+		done = 1;
+	}
 }
 
 // Unmap any file pages that no longer represent valid file pages
 // when the size of the file as mapped in our address space decreases.
 // Harmlessly does nothing if newsize >= oldsize.
 //
-// Hint: Remember to call fsipc_dirty if dirty is true and PTE_D bit
-// is set in the pagetable entry.
-// Hint: Use fd2data to get the start of the file mapping area for fd.
-// Hint: You can use ROUNDUP to page-align offsets.
-static int
+// If dirty is true, pages with the PTE_D bit set are queued to be
+// reported dirty; the caller passes them to the server with
+// fsring_enter.
+static void
 funmap(struct Fd* fd, off_t oldsize, off_t newsize, bool dirty)
 {
   uint32_t fileid = fd->fd_file.id;
   off_t off = ROUNDUP(newsize, PGSIZE);
   char *va = fd2data(fd);
-  int r, ret = 0;
 
+  oldsize = MIN(oldsize, (off_t) FMAPSIZE);
   for (; off < oldsize; off+=PGSIZE) {
-    if (dirty && (vpt[VPN(va+off)] & PTE_D)) {
-      r = fsipc_dirty(fileid, off);
-      if (r)
-        ret = r;
-    }
+    if (!page_is_mapped(va+off))
+      continue;
+    if (dirty && (vpt[VPN(va+off)] & PTE_D))
+      fsring_dirty(fileid, off);
     sys_page_unmap(0, va+off);
   }
-  return ret;
 }
 
 // Delete a file
@@ -221,7 +338,8 @@ remove(const char *path)
 	return fsipc_remove(path);
 }
 
-// Synchronize disk with buffer cache
+// Synchronize disk with buffer cache.
+// Returns the number of blocks written, or < 0 on error.
 int
 sync(void)
 {
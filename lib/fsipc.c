@@ -4,6 +4,14 @@
 #define debug 0
 
 extern uint8_t fsipcbuf[PGSIZE];	// page-aligned, declared in entry.S
+extern uint8_t fsringbuf[PGSIZE];	// likewise
+
+// The request ring, set up on first use.  A forked or spawned child
+// sees its parent's ring, so ringenv records whose ring it is.
+static struct Fsring *ring = (struct Fsring*) fsringbuf;
+static envid_t ringenv;		// environment the ring belongs to
+static envid_t ringfail;	// environment that failed to set one up
+static int ringerr;		// first error among the current batch
 
 // Send an IP request to the file server, and wait for a reply.
 // type: request code, passed as the simple integer IPC value.
@@ -56,6 +64,28 @@ fsipc_map(int fileid, off_t offset, void *dstva)
   return fsipc(FSREQ_MAP, req, dstva, 0);
 }
 
+// Ask the file server to map up to 'npages' pages of the file, starting
+// at the page holding 'offset', at consecutive addresses from 'dstva',
+// in a single round trip.
+// Returns the number of pages mapped, or < 0 on failure.
+int
+fsipc_map_range(int fileid, off_t offset, void *dstva, size_t npages)
+{
+	int r;
+	envid_t whom;
+	struct Fsreq_map_range *req;
+
+	req = (struct Fsreq_map_range*) fsipcbuf;
+	req->req_fileid = fileid;
+	req->req_offset = offset;
+	req->req_npages = npages;
+
+	ipc_send(envs[1].env_id, FSREQ_MAP_RANGE, req, PTE_P | PTE_W | PTE_U);
+	if ((r = ipc_recv_pages(&whom, dstva, &npages, 0)) < 0)
+		return r;
+	return npages;
+}
+
 // Make a set-file-size request to the file server.
 int
 fsipc_set_size(int fileid, off_t size)
@@ -68,6 +98,19 @@ fsipc_set_size(int fileid, off_t size)
 	return fsipc(FSREQ_SET_SIZE, req, 0, 0);
 }
 
+// Ask the file server to reserve the blocks of a file up to 'size' bytes
+// and extend the file to that size.
+int
+fsipc_allocate(int fileid, off_t size)
+{
+	struct Fsreq_allocate *req;
+
+	req = (struct Fsreq_allocate*) fsipcbuf;
+	req->req_fileid = fileid;
+	req->req_size = size;
+	return fsipc(FSREQ_ALLOCATE, req, 0, 0);
+}
+
 // Make a file-close request to the file server.
 // After this the fileid is invalid.
 int
@@ -111,3 +154,109 @@ fsipc_sync(void)
 	return fsipc(FSREQ_SYNC, fsipcbuf, 0, 0);
 }
 
+
+// Give the file server a fresh ring page for this environment,
+// unless it already has one.  The page is mapped PTE_SHARE so that
+// fork does not turn it copy-on-write under the server.
+static int
+fsring_setup(void)
+{
+	int r;
+
+	if (ringenv == env->env_id)
+		return 0;
+	if (ringfail == env->env_id)
+		return -E_INVAL;
+	if ((r = sys_page_alloc(0, ring, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0
+	    || (r = fsipc(FSREQ_RING_SETUP, ring, 0, 0)) < 0) {
+		ringfail = env->env_id;
+		return r;
+	}
+	ringenv = env->env_id;
+	ringerr = 0;
+	return 0;
+}
+
+// Return a free request slot in the ring, first passing the queued
+// requests to the server if the ring is full, or return 0 if there is
+// no ring to use.
+static struct Fsring_sqe *
+fsring_get_sqe(void)
+{
+	int r;
+
+	if (fsring_setup() < 0)
+		return 0;
+	if (ring->sq_tail - ring->sq_head == FSRING_SIZE) {
+		if ((r = fsring_enter()) < 0)
+			ringerr = r;
+		if (ringenv != env->env_id)
+			return 0;
+	}
+	return &ring->sq[ring->sq_tail % FSRING_SIZE];
+}
+
+// Queue a request to mark a file block dirty, like fsipc_dirty.
+// Errors are reported by the next fsring_enter.
+void
+fsring_dirty(int fileid, off_t offset)
+{
+	int r;
+	struct Fsring_sqe *sqe;
+
+	if ((sqe = fsring_get_sqe()) == 0) {
+		if ((r = fsipc_dirty(fileid, offset)) < 0 && ringerr == 0)
+			ringerr = r;
+		return;
+	}
+	sqe->sqe_type = FSREQ_DIRTY;
+	sqe->sqe_req.dirty.req_fileid = fileid;
+	sqe->sqe_req.dirty.req_offset = offset;
+	ring->sq_tail++;
+}
+
+// Queue a file-close request, like fsipc_close.
+void
+fsring_close(int fileid)
+{
+	int r;
+	struct Fsring_sqe *sqe;
+
+	if ((sqe = fsring_get_sqe()) == 0) {
+		if ((r = fsipc_close(fileid)) < 0 && ringerr == 0)
+			ringerr = r;
+		return;
+	}
+	sqe->sqe_type = FSREQ_CLOSE;
+	sqe->sqe_req.close.req_fileid = fileid;
+	ring->sq_tail++;
+}
+
+// Hand every queued request to the file server in one IPC and wait for
+// them all to be served.
+// Returns 0 if they all succeeded, or the first error among them
+// (and among any queued since the last call).
+int
+fsring_enter(void)
+{
+	int r;
+	envid_t whom;
+
+	if (ringenv == env->env_id && ring->sq_tail != ring->sq_head) {
+		ipc_send(envs[1].env_id, FSREQ_RING_ENTER, 0, 0);
+		if ((r = ipc_recv(&whom, 0, 0)) < 0) {
+			// The server dropped our ring; don't use it again.
+			ringenv = 0;
+			ringfail = env->env_id;
+			if (ringerr == 0)
+				ringerr = r;
+		}
+		for (; ring->cq_head != ring->cq_tail; ring->cq_head++)
+			if ((r = ring->cq[ring->cq_head % FSRING_SIZE].cqe_result) < 0
+			    && ringerr == 0)
+				ringerr = r;
+	}
+	r = ringerr;
+	ringerr = 0;
+	return r;
+}
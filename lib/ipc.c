@@ -56,3 +56,55 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
       return;
   }
 }
+
+// Like ipc_send, but sends the 'npages' pages at pgs[0], pgs[1], ...
+// to consecutive pages at the receiver (a null entry leaves a hole).
+void
+ipc_send_pages(envid_t to_env, uint32_t val, void **pgs, size_t npages, int perm)
+{
+  int r;
+
+  while ((r = sys_ipc_try_send_pages(to_env, val, pgs, npages, perm)) == -E_IPC_NOT_RECV)
+    sys_yield();
+  if (r < 0)
+    panic("sys_ipc_try_send_pages: %e\n", r);
+}
+
+static int32_t ipc_recv_result(int r, envid_t *from_env_store, size_t *npages,
+                               int *perm_store);
+
+// Like ipc_recv, but accepts up to *npages pages mapped from 'pg' on.
+// On return *npages holds the number of page slots the sender filled.
+int32_t
+ipc_recv_pages(envid_t *from_env_store, void *pg, size_t *npages, int *perm_store)
+{
+  int r;
+
+  r = sys_ipc_recv_pages(pg ? pg : (void*) UTOP, *npages);
+  return ipc_recv_result(r, from_env_store, npages, perm_store);
+}
+
+// Like ipc_recv_pages, but gives up at time 'msec', as returned by
+// sys_time_msec, and returns -E_TIMEOUT.
+int32_t
+ipc_recv_timed(envid_t *from_env_store, void *pg, size_t *npages, int *perm_store,
+               unsigned int msec)
+{
+  int r;
+
+  r = sys_ipc_recv_timed(pg ? pg : (void*) UTOP, *npages, msec);
+  return ipc_recv_result(r, from_env_store, npages, perm_store);
+}
+
+static int32_t
+ipc_recv_result(int r, envid_t *from_env_store, size_t *npages, int *perm_store)
+{
+  env = envs + ENVX(sys_getenvid());
+
+  if (from_env_store)
+    *from_env_store = r ? 0 : env->env_ipc_from;
+  if (perm_store)
+    *perm_store = r ? 0 : env->env_ipc_perm;
+  *npages = r ? 0 : env->env_ipc_npages;
+  return r ? r : env->env_ipc_value;
+}
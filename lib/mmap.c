@@ -0,0 +1,211 @@
+// Memory-mapped files.
+//
+// mmap() maps part of an open file at an address it picks between
+// MMAPDATA and MMAPTOP.  Nothing is mapped up front: the first touch of
+// a page faults, and mmap_pgfault maps it and up to FAULTAROUND-1
+// unmapped pages after it straight from the file server's block cache.
+// MAP_SHARED pages are the block cache pages themselves.  MAP_PRIVATE
+// pages start out as the same pages, read-only or copy-on-write.
+//
+// Each mapping holds its own reference to the open file's Fd page, so
+// it stays valid after the file descriptor is closed.
+
+#include <inc/fs.h>
+#include <inc/string.h>
+#include <inc/lib.h>
+
+// PTE_COW marks copy-on-write page table entries, as in fork.c.
+#define PTE_COW		0x800
+
+#define NMMAP		32
+#define MMAPBASE	0xE0000000
+// Fd page referenced by mapping i
+#define MMAPFD(i)	((struct Fd*) (MMAPBASE + (i)*PGSIZE))
+#define MMAPDATA	(MMAPBASE + PTSIZE)
+#define MMAPTOP		0xEE000000
+
+#define FAULTAROUND	16
+
+struct Mmap {
+	uintptr_t m_va;		// first address, or 0 if the slot is free
+	size_t m_len;		// length in bytes, a multiple of PGSIZE
+	off_t m_offset;		// file offset mapped at m_va
+	int m_prot;		// PROT_ flags
+	int m_flags;		// MAP_SHARED or MAP_PRIVATE
+};
+
+static struct Mmap mmaps[NMMAP];
+
+static bool
+page_is_mapped(uintptr_t va)
+{
+	return (vpd[PDX(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P);
+}
+
+// Find the mapping that contains 'va', or return -1.
+static int
+mmap_lookup(uintptr_t va)
+{
+	int i;
+
+	for (i = 0; i < NMMAP; i++)
+		if (mmaps[i].m_va && mmaps[i].m_va <= va
+		    && va < mmaps[i].m_va + mmaps[i].m_len)
+			return i;
+	return -1;
+}
+
+// Find the lowest free 'len' bytes of the mapping area, or return 0.
+static uintptr_t
+mmap_find_space(size_t len)
+{
+	int i;
+	uintptr_t va = MMAPDATA;
+
+again:
+	for (i = 0; i < NMMAP; i++)
+		if (mmaps[i].m_va && va < mmaps[i].m_va + mmaps[i].m_len
+		    && mmaps[i].m_va < va + len) {
+			va = mmaps[i].m_va + mmaps[i].m_len;
+			goto again;
+		}
+	return (len <= MMAPTOP - va) ? va : 0;
+}
+
+// Give the faulting process its own copy of a copy-on-write page.
+static void
+mmap_copy_page(uintptr_t va)
+{
+	int r;
+
+	if ((r = sys_page_alloc(0, PFTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+	memmove(PFTEMP, (void*) va, PGSIZE);
+	if ((r = sys_page_map(0, PFTEMP, 0, (void*) va, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("sys_page_map: %e", r);
+	if ((r = sys_page_unmap(0, PFTEMP)) < 0)
+		panic("sys_page_unmap: %e", r);
+}
+
+// Resolve faults in mapped files.
+static int
+mmap_pgfault(struct UTrapframe *utf)
+{
+	int i, n, r, err, perm;
+	uintptr_t va = ROUNDDOWN(utf->utf_fault_va, PGSIZE);
+	bool write = (utf->utf_err & FEC_WR) != 0;
+	struct Mmap *m;
+
+	if ((i = mmap_lookup(va)) < 0)
+		return -E_INVAL;
+	m = &mmaps[i];
+	if (write && !(m->m_prot & PROT_WRITE))
+		return -E_INVAL;
+
+	if (page_is_mapped(va)) {
+		if (!write || !(vpt[VPN(va)] & PTE_COW))
+			return -E_INVAL;
+		mmap_copy_page(va);
+		return 0;
+	}
+	if (!(m->m_prot & (PROT_READ|PROT_WRITE)))
+		return -E_INVAL;
+
+	for (n = 1; n < FAULTAROUND && va + n*PGSIZE < m->m_va + m->m_len
+		     && !page_is_mapped(va + n*PGSIZE); n++)
+		;
+	r = fsipc_map_range(MMAPFD(i)->fd_file.id, m->m_offset + (va - m->m_va),
+			    (void*) va, n);
+	if (r <= 0)	// error, or past the end of the file
+		return r < 0 ? r : -E_INVAL;
+
+	// The file server mapped the pages shared and, for a file open
+	// for writing, writable.  Take that away where writes must not
+	// reach the file; a write to a private page then gets a copy.
+	if (m->m_flags == MAP_PRIVATE || !(m->m_prot & PROT_WRITE)) {
+		perm = PTE_P|PTE_U;
+		if (m->m_flags == MAP_PRIVATE && (m->m_prot & PROT_WRITE))
+			perm |= PTE_COW;
+		for (n = 0; n < r; n++)
+			if ((err = sys_page_map(0, (void*) (va + n*PGSIZE),
+						0, (void*) (va + n*PGSIZE), perm)) < 0)
+				panic("sys_page_map: %e", err);
+	}
+	return 0;
+}
+
+// Map 'len' bytes of the open file 'fdnum', starting at 'offset', which
+// must be page-aligned.  'prot' is PROT_READ and/or PROT_WRITE; 'flags'
+// is MAP_SHARED (writes go to the file) or MAP_PRIVATE (they don't).
+// Touching a page beyond the end of the file is a fatal fault.
+// On success, stores the address of the mapping in *va_store.
+// Returns 0 on success, < 0 on error.
+int
+mmap(int fdnum, off_t offset, size_t len, int prot, int flags, void **va_store)
+{
+	int i, r;
+	uintptr_t va;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id || len == 0
+	    || offset < 0 || offset % PGSIZE != 0
+	    || (flags != MAP_SHARED && flags != MAP_PRIVATE))
+		return -E_INVAL;
+	if ((prot & PROT_WRITE) && flags == MAP_SHARED
+	    && (fd->fd_omode & O_ACCMODE) == O_RDONLY)
+		return -E_INVAL;
+
+	len = ROUNDUP(len, PGSIZE);
+	for (i = 0; i < NMMAP && mmaps[i].m_va; i++)
+		;
+	if (i == NMMAP || (va = mmap_find_space(len)) == 0)
+		return -E_NO_MEM;
+	if ((r = sys_page_map(0, fd, 0, MMAPFD(i), vpt[VPN(fd)] & PTE_USER)) < 0)
+		return r;
+	add_pgfault_handler(mmap_pgfault);
+
+	mmaps[i].m_va = va;
+	mmaps[i].m_len = len;
+	mmaps[i].m_offset = offset;
+	mmaps[i].m_prot = prot;
+	mmaps[i].m_flags = flags;
+	*va_store = (void*) va;
+	return 0;
+}
+
+// Remove the mapping that starts at 'va'.  Only whole mappings can be
+// removed; 'len' must not exceed the mapping.  Changes made through a
+// shared mapping are handed to the file server and flushed.
+// Returns 0 on success, < 0 on error.
+int
+munmap(void *va, size_t len)
+{
+	int i;
+	bool dirty = 0;
+	uintptr_t p;
+	struct Mmap *m;
+
+	if ((i = mmap_lookup((uintptr_t) va)) < 0
+	    || mmaps[i].m_va != (uintptr_t) va || len > mmaps[i].m_len)
+		return -E_INVAL;
+	m = &mmaps[i];
+
+	for (p = m->m_va; p < m->m_va + m->m_len; p += PGSIZE) {
+		if (!page_is_mapped(p))
+			continue;
+		if (m->m_flags == MAP_SHARED && (vpt[VPN(p)] & PTE_D)) {
+			fsring_dirty(MMAPFD(i)->fd_file.id,
+				     m->m_offset + (p - m->m_va));
+			dirty = 1;
+		}
+		sys_page_unmap(0, (void*) p);
+	}
+	if (dirty)
+		fsring_close(MMAPFD(i)->fd_file.id);
+
+	sys_page_unmap(0, MMAPFD(i));
+	m->m_va = 0;
+	return fsring_enter();
+}
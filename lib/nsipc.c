@@ -8,6 +8,9 @@
 #define REQVA		0x0ffff000
 extern uint8_t nsipcbuf[PGSIZE];	// page-aligned, declared in entry.S
 
+// Data pages on their way to or from the network server are mapped here.
+#define DATAVA		((char*) (PFTEMP - (1 + NSREQ_MAXDATA) * PGSIZE))
+
 // Send an IP request to the network server, and wait for a reply.
 // type: request code, passed as the simple integer IPC value.
 // fsreq: page to send containing additional request data, usually fsipcbuf.
@@ -107,40 +110,173 @@ nsipc_listen(int s, int backlog)
 	return nsipc(NSREQ_LISTEN, req, 0, &perm);
 }
 
+// Receive up to 'len' bytes, which the server sends back in up to
+// NSREQ_MAXDATA pages mapped at DATAVA.
 int
 nsipc_recv(int s, void *mem, int len, unsigned int flags)
 {
-	int perm, r;
+	int r;
+	size_t i, npages;
+	envid_t whom;
 	struct Nsreq_recv *req;
-	void *ret;
 	
 	req = (struct Nsreq_recv*)nsipcbuf;
 	req->req_s = s;
 	req->req_len = len;
 	req->req_flags = flags;
 	
-	r = nsipc(NSREQ_RECV, req, (void *)REQVA, &perm);
+	ipc_send(envs[2].env_id, NSREQ_RECV, req, PTE_P|PTE_W|PTE_U);
+	npages = NSREQ_MAXDATA;
+	r = ipc_recv_pages(&whom, DATAVA, &npages, 0);
 	
-	assert(r < 1600 && r <= len);
-	ret = (void *) REQVA;
-	memmove(mem, ret, r);
+	if (r > 0) {
+		assert(r <= len && r <= (int) (npages * PGSIZE));
+		memmove(mem, DATAVA, r);
+	}
+	for (i = 0; i < npages; i++)
+		sys_page_unmap(0, DATAVA + i * PGSIZE);
 	
 	return r;
 }
 
+// Hand the 'npages' pages at pgs[0], pgs[1], ... to the network
+// server to send 'size' bytes from, starting 'offset' bytes into the
+// first page.
+static int
+nsipc_sendpages(unsigned type, int s, void **pgs, size_t npages, int offset, int size, unsigned int flags)
+{
+	envid_t whom;
+	struct Nsreq_sendpages *req;
+	void *sendpgs[1 + NSREQ_MAXDATA];
+
+	assert(npages <= NSREQ_MAXDATA);
+	req = (struct Nsreq_sendpages*)nsipcbuf;
+	req->req_s = s;
+	req->req_offset = offset;
+	req->req_size = size;
+	req->req_flags = flags;
+
+	sendpgs[0] = req;
+	memmove(&sendpgs[1], pgs, npages * sizeof(void*));
+	ipc_send_pages(envs[2].env_id, type, sendpgs, 1 + npages, PTE_P|PTE_U);
+	return ipc_recv(&whom, 0, 0);
+}
+
+// Data that fits in the request page is copied there.  Larger sends
+// pass the pages holding the caller's data, up to NSREQ_MAXDATA at a
+// time, and the server sends straight from them.  On a non-blocking
+// socket this returns early, with the number of bytes sent, once the
+// send buffer is full.
 int
 nsipc_send(int s, const void *dataptr, int size, unsigned int flags)
 {
-	int perm;
+	int perm, r, n, pgoff, sent;
+	size_t i, npages;
+	const char *p;
 	struct Nsreq_send *req;
+	void *pgs[NSREQ_MAXDATA];
 	
-	req = (struct Nsreq_send*)nsipcbuf;
+	if (size <= (int) (PGSIZE - sizeof(struct Nsreq_send))) {
+		req = (struct Nsreq_send*)nsipcbuf;
+		req->req_s = s;
+		memmove(&req->req_dataptr, dataptr, size);
+		req->req_size = size;
+		req->req_flags = flags;
+		return nsipc(NSREQ_SEND, req, 0, &perm);
+	}
+
+	for (sent = 0; sent < size; sent += r) {
+		p = (const char *) dataptr + sent;
+		pgoff = (uintptr_t) p % PGSIZE;
+		n = MIN(size - sent, NSREQ_MAXDATA * PGSIZE - pgoff);
+		npages = ROUNDUP(pgoff + n, PGSIZE) / PGSIZE;
+		for (i = 0; i < npages; i++) {
+			pgs[i] = (void *) ROUNDDOWN(p, PGSIZE) + i * PGSIZE;
+			// fault in pages that are mapped on demand
+			(void) *(volatile const char *) pgs[i];
+		}
+		r = nsipc_sendpages(NSREQ_SENDPAGES, s, pgs, npages, pgoff, n,
+				    sent + n < size ? (flags | MSG_MORE) : flags);
+		if (r < 0)
+			return sent > 0 ? sent : r;
+		if (r < n)	// non-blocking, and the send buffer is full
+			return sent + r;
+	}
+	return sent;
+}
+
+// Send up to 'size' bytes of the open file 'fileid', from 'offset' on,
+// mapping up to NSREQ_MAXDATA of its pages from the file server and
+// passing them on to the network server.
+// Returns the number of bytes sent, 0 at the end of the file, or < 0.
+int
+nsipc_sendfile(int s, int fileid, off_t offset, int size, unsigned int flags)
+{
+	int r, n, pgoff, chunk;
+	size_t i;
+	void *pgs[NSREQ_MAXDATA];
+
+	pgoff = offset % PGSIZE;
+	n = MIN((size_t) NSREQ_MAXDATA, ROUNDUP(pgoff + size, PGSIZE) / PGSIZE);
+	if ((r = fsipc_map_range(fileid, offset - pgoff, DATAVA, n)) <= 0)
+		return r;
+	for (i = 0; i < (size_t) r; i++)
+		pgs[i] = DATAVA + i * PGSIZE;
+	chunk = MIN(size, r * PGSIZE - pgoff);
+	r = nsipc_sendpages(NSREQ_SENDFILE, s, pgs, r, pgoff, chunk,
+			    chunk < size ? (flags | MSG_MORE) : flags);
+	for (i = 0; i < NSREQ_MAXDATA; i++)
+		sys_page_unmap(0, DATAVA + i * PGSIZE);
+	return r;
+}
+
+int
+nsipc_ioctl(int s, long cmd, uint32_t *arg)
+{
+	int perm, r;
+	struct Nsreq_ioctl *req;
+
+	req = (struct Nsreq_ioctl*)nsipcbuf;
 	req->req_s = s;
-	assert(size < 1600);
-	memmove(&req->req_dataptr, dataptr, size);
-	req->req_size = size;
-	req->req_flags = flags;
-	return nsipc(NSREQ_SEND, req, 0, &perm);
+	req->req_cmd = cmd;
+	req->req_arg = *arg;
+	r = nsipc(NSREQ_IOCTL, req, (void *)REQVA, &perm);
+	*arg = ((struct Nsreq_ioctl*) REQVA)->req_arg;
+	return r;
+}
+
+// Any of the sets may be null; a null timeout waits forever.
+int
+nsipc_select(int nfds, fd_set *readset, fd_set *writeset, fd_set *exceptset,
+	     struct timeval *timeout)
+{
+	int perm, r;
+	struct Nsreq_select *req, *ret;
+
+	req = (struct Nsreq_select*)nsipcbuf;
+	memset(req, 0, sizeof(*req));
+	req->req_nfds = nfds;
+	if (readset)
+		req->req_readset = *readset;
+	if (writeset)
+		req->req_writeset = *writeset;
+	if (exceptset)
+		req->req_exceptset = *exceptset;
+	if (timeout) {
+		req->req_hastimeout = 1;
+		req->req_timeout = *timeout;
+	}
+
+	r = nsipc(NSREQ_SELECT, req, (void *)REQVA, &perm);
+
+	ret = (struct Nsreq_select*) REQVA;
+	if (readset)
+		*readset = ret->req_readset;
+	if (writeset)
+		*writeset = ret->req_writeset;
+	if (exceptset)
+		*exceptset = ret->req_exceptset;
+	return r;
 }
 
 int
@@ -9,17 +9,33 @@
 extern void _pgfault_upcall(void);
 
 // Pointer to currently installed C-language pgfault handler.
+// Once set, it is always pgfault_dispatch.
 void (*_pgfault_handler)(struct UTrapframe *utf);
 
-//
-// Set the page fault handler function.
-// If there isn't one yet, _pgfault_handler will be 0.
-//
-void
-set_pgfault_handler(void (*handler)(struct UTrapframe *utf))
+// Handlers that each resolve faults in some region of memory, such as
+// lazily mapped files, returning 0 if they did.  They are tried in
+// order before the handler given to set_pgfault_handler.
+#define NPFHANDLERS	4
+static int (*pfhandlers[NPFHANDLERS])(struct UTrapframe *utf);
+static void (*pfdefault)(struct UTrapframe *utf);
+
+static void
+pgfault_dispatch(struct UTrapframe *utf)
 {
-	int r;
+	int i;
 
+	for (i = 0; i < NPFHANDLERS && pfhandlers[i]; i++)
+		if (pfhandlers[i](utf) == 0)
+			return;
+	if (!pfdefault)
+		panic("unhandled page fault va %08x ip %08x err %x",
+		      utf->utf_fault_va, utf->utf_eip, utf->utf_err);
+	pfdefault(utf);
+}
+
+static void
+pgfault_init(void)
+{
 	if (_pgfault_handler == 0) {
 // The first time we register a handler, we need to 
 // allocate an exception stack (one page of memory with its top
@@ -33,6 +49,35 @@ set_pgfault_handler(void (*handler)(struct UTrapframe *utf))
 	}
 
 	// Save handler pointer for assembly to call.
-	_pgfault_handler = handler;
+	_pgfault_handler = pgfault_dispatch;
+}
+
+//
+// Set the page fault handler function.
+//
+void
+set_pgfault_handler(void (*handler)(struct UTrapframe *utf))
+{
+	pgfault_init();
+	pfdefault = handler;
+}
+
+//
+// Add a handler for the faults in some region of memory.
+// It returns 0 if it resolved the fault, < 0 to pass it on.
+// Adding the same handler twice has no effect.
+//
+void
+add_pgfault_handler(int (*handler)(struct UTrapframe *utf))
+{
+	int i;
+
+	pgfault_init();
+	for (i = 0; i < NPFHANDLERS && pfhandlers[i]; i++)
+		if (pfhandlers[i] == handler)
+			return;
+	if (i == NPFHANDLERS)
+		panic("add_pgfault_handler: too many handlers");
+	pfhandlers[i] = handler;
 }
 
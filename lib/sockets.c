@@ -54,3 +54,65 @@ socket(int domain, int type, int protocol)
 {
 	return nsipc_socket(domain, type, protocol);
 }
+
+// Only FIONBIO, which makes 's' non-blocking if *argp is nonzero, and
+// FIONREAD, which stores the number of bytes ready to read in *argp,
+// are supported.  Calls on a non-blocking socket that would block
+// return -E_WOULD_BLOCK instead.
+int
+ioctlsocket(int s, long cmd, void *argp)
+{
+	int r;
+	uint32_t arg = 0;
+
+	if (cmd != FIONBIO && cmd != FIONREAD)
+		return -E_INVAL;
+	if (cmd == FIONBIO)
+		arg = *(uint32_t *) argp;
+	r = nsipc_ioctl(s, cmd, &arg);
+	if (r >= 0 && cmd == FIONREAD)
+		*(uint32_t *) argp = arg;
+	return r;
+}
+
+// Wait until one of the sockets in the sets is ready, or 'timeout'
+// passes, in a single request to the network server.  On return the
+// sets hold only the sockets that are ready.
+// Returns the number of ready sockets, 0 on timeout, or < 0 on error.
+int
+select(int nfds, fd_set *readset, fd_set *writeset, fd_set *exceptset,
+       struct timeval *timeout)
+{
+	return nsipc_select(nfds, readset, writeset, exceptset, timeout);
+}
+
+// Send up to 'len' bytes of the open file 'fdnum', from 'offset' on,
+// on socket 's'.  The data goes from the file server's block cache to
+// the network server a batch of pages at a time, without being copied.
+// Returns the number of bytes sent, or < 0 on error; -E_INVAL if
+// 'fdnum' is not a file.
+int
+sendfile(int s, int fdnum, off_t offset, size_t len)
+{
+	int r;
+	size_t sent = 0;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id || offset < 0)
+		return -E_INVAL;
+	if (offset >= fd->fd_file.file.f_size)
+		return 0;
+	len = MIN(len, (size_t) (fd->fd_file.file.f_size - offset));
+
+	do {
+		r = nsipc_sendfile(s, fd->fd_file.id, offset, len - sent, 0);
+		if (r <= 0)
+			break;
+		sent += r;
+		offset += r;
+	} while (sent < len);
+
+	return (sent > 0 || r >= 0) ? (int) sent : r;
+}
@@ -143,12 +143,42 @@ sys_ipc_recv(void *dstva)
 	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
 }
 
+int
+sys_ipc_try_send_pages(envid_t envid, uint32_t value, void **srcvas, size_t npages, int perm)
+{
+	return syscall(SYS_ipc_try_send_pages, 0, envid, value, (uint32_t) srcvas, npages, perm);
+}
+
+int
+sys_ipc_recv_pages(void *dstva, size_t npages)
+{
+	return syscall(SYS_ipc_recv_pages, 1, (uint32_t)dstva, npages, 0, 0, 0);
+}
+
+int
+sys_ipc_recv_timed(void *dstva, size_t npages, unsigned int msec)
+{
+	return syscall(SYS_ipc_recv_timed, 1, (uint32_t)dstva, npages, msec, 0, 0);
+}
+
 unsigned int
 sys_time_msec(void)
 {
 	return (unsigned int) syscall(SYS_time_msec, 0, 0, 0, 0, 0, 0);
 }
 
+int
+sys_time_nsec(uint64_t *nsec)
+{
+	return syscall(SYS_time_nsec, 0, (uint32_t) nsec, 0, 0, 0, 0);
+}
+
+int
+sys_time_sleep(unsigned int msec)
+{
+	return syscall(SYS_time_sleep, 0, msec, 0, 0, 0, 0);
+}
+
 int sys_net_txbuf(void *bufva, unsigned int size)
 {
   return syscall(SYS_net_txbuf, 1, (uint32_t) bufva, size, 0, 0, 0);
@@ -158,3 +188,26 @@ int sys_net_rxbuf(void *bufva, unsigned int size)
 {
   return syscall(SYS_net_rxbuf, 1, (uint32_t) bufva, size, 0, 0, 0);
 }
+
+// Post 'n' buffers at once, bufs[i] holding sizes[i] bytes.
+// At most 64, the size of the device's rings.
+int sys_net_txbufs(void **bufs, unsigned int *sizes, int n)
+{
+  return syscall(SYS_net_txbufs, 1, (uint32_t) bufs, (uint32_t) sizes, n, 0, 0);
+}
+
+int sys_net_rxbufs(void **bufs, unsigned int *sizes, int n)
+{
+  return syscall(SYS_net_rxbufs, 1, (uint32_t) bufs, (uint32_t) sizes, n, 0, 0);
+}
+
+int sys_net_txfrags(void **bufs, unsigned int *sizes, int n)
+{
+  return syscall(SYS_net_txfrags, 1, (uint32_t) bufs, (uint32_t) sizes, n, 0, 0);
+}
+
+// Have ipc_recv return 'value' from envid 0 when packets arrive.
+int sys_net_rxnotify(uint32_t value)
+{
+  return syscall(SYS_net_rxnotify, 1, value, 0, 0, 0, 0);
+}
@@ -258,6 +258,12 @@ lwip_accept(int s, struct sockaddr *addr, socklen_t *addrlen)
   if (!sock)
     return -1;
 
+  /* JOS: don't wait for a connection on a non-blocking socket */
+  if ((sock->flags & O_NONBLOCK) && !sock->rcvevent) {
+    sock_set_errno(sock, EWOULDBLOCK);
+    return -1;
+  }
+
   newconn = netconn_accept(sock->conn);
   if (!newconn) {
     LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_accept(%d) failed, err=%d\n", s, sock->conn->err));
@@ -627,6 +633,17 @@ lwip_send(int s, const void *data, int size, unsigned int flags)
 #endif /* (LWIP_UDP || LWIP_RAW) */
   }
 
+  /* JOS: on a non-blocking socket, queue only what fits in the send buffer */
+  if ((flags & MSG_DONTWAIT) || (sock->flags & O_NONBLOCK)) {
+    if (sock->conn->pcb.tcp != NULL && size > tcp_sndbuf(sock->conn->pcb.tcp)) {
+      size = tcp_sndbuf(sock->conn->pcb.tcp);
+      if (size == 0) {
+        sock_set_errno(sock, EWOULDBLOCK);
+        return -1;
+      }
+    }
+  }
+
   err = netconn_write(sock->conn, data, size, NETCONN_COPY | ((flags & MSG_MORE)?NETCONN_MORE:0));
 
   LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send(%d) err=%d size=%d\n", s, err, size));
@@ -634,6 +651,125 @@ lwip_send(int s, const void *data, int size, unsigned int flags)
   return (err==ERR_OK?size:-1);
 }
 
+/* JOS: data passed to lwip_send_ref, and how many PBUF_ROM pbufs that
+ * tcp_enqueue made for it are still around.  The pbufs are marked
+ * PBUF_FLAG_SENDREF, and pbuf_free tells us when each goes away, so
+ * lwip_send_ref_wait sleeps until lwIP is done with the data, whatever
+ * becomes of the connection meanwhile. */
+#ifndef LWIP_SEND_REFS
+#define LWIP_SEND_REFS 16
+#endif
+
+struct send_ref {
+  const char *data;     /* NULL if the slot is free */
+  int size;
+  int npbufs;
+  u8_t waiting;
+  sys_sem_t done;       /* signalled when npbufs drops to 0 while waiting */
+};
+
+static struct send_ref send_refs[LWIP_SEND_REFS];
+
+static struct send_ref *
+send_ref_find(const char *payload)
+{
+  int i;
+
+  for (i = 0; i < LWIP_SEND_REFS; i++)
+    if (send_refs[i].data != NULL && send_refs[i].data <= payload
+        && payload < send_refs[i].data + send_refs[i].size)
+      return &send_refs[i];
+  return NULL;
+}
+
+void
+pbuf_sendref_hold(struct pbuf *p)
+{
+  struct send_ref *ref = send_ref_find(p->payload);
+
+  if (ref != NULL) {
+    ref->npbufs++;
+    p->flags |= PBUF_FLAG_SENDREF;
+  }
+}
+
+void
+pbuf_sendref_free(struct pbuf *p)
+{
+  struct send_ref *ref = send_ref_find(p->payload);
+
+  LWIP_ASSERT("pbuf_sendref_free: no send_ref", ref != NULL);
+  if (--ref->npbufs == 0 && ref->waiting)
+    sys_sem_signal(ref->done);
+}
+
+/* JOS: like lwip_send on a TCP socket, but the segments refer to 'data'
+ * where it is (PBUF_ROM) instead of copying it, so it must stay put until
+ * lwip_send_ref_wait says lwIP is done with it.  *ref gets what to pass
+ * to lwip_send_ref_wait, which must be called even if the send fails,
+ * unless *ref is NULL. */
+int
+lwip_send_ref(int s, const void *data, int size, unsigned int flags, void **ref)
+{
+  struct lwip_socket *sock;
+  struct send_ref *sr;
+  err_t err;
+  int i;
+
+  *ref = NULL;
+  sock = get_socket(s);
+  if (!sock)
+    return -1;
+  if (sock->conn->type != NETCONN_TCP) {
+    sock_set_errno(sock, err_to_errno(ERR_ARG));
+    return -1;
+  }
+
+  if ((flags & MSG_DONTWAIT) || (sock->flags & O_NONBLOCK)) {
+    if (sock->conn->pcb.tcp != NULL && size > tcp_sndbuf(sock->conn->pcb.tcp)) {
+      size = tcp_sndbuf(sock->conn->pcb.tcp);
+      if (size == 0) {
+        sock_set_errno(sock, EWOULDBLOCK);
+        return -1;
+      }
+    }
+  }
+
+  for (i = 0; i < LWIP_SEND_REFS && send_refs[i].data != NULL; i++)
+    ;
+  if (i == LWIP_SEND_REFS || (send_refs[i].done = sys_sem_new(0)) == SYS_SEM_NULL) {
+    sock_set_errno(sock, ENOMEM);
+    return -1;
+  }
+  sr = &send_refs[i];
+  sr->data = data;
+  sr->size = size;
+  sr->npbufs = 0;
+  sr->waiting = 0;
+  *ref = sr;
+
+  err = netconn_write(sock->conn, data, size, NETCONN_NOCOPY | ((flags & MSG_MORE)?NETCONN_MORE:0));
+
+  sock_set_errno(sock, err_to_errno(err));
+  return (err==ERR_OK?size:-1);
+}
+
+/* JOS: wait until no pbuf refers to the data passed to lwip_send_ref
+ * any more: it has all been acknowledged, or the connection is gone. */
+void
+lwip_send_ref_wait(void *ref)
+{
+  struct send_ref *sr = ref;
+
+  while (sr->npbufs > 0) {
+    sr->waiting = 1;
+    sys_sem_wait(sr->done);
+    sr->waiting = 0;
+  }
+  sys_sem_free(sr->done);
+  sr->data = NULL;
+}
+
 int
 lwip_sendto(int s, const void *data, int size, unsigned int flags,
        struct sockaddr *to, socklen_t tolen)
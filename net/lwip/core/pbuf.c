@@ -399,6 +399,10 @@ pbuf_header(struct pbuf *p, s16_t header_size_increment)
     if ((header_size_increment < 0) && (increment_magnitude <= p->len)) {
       /* increase payload pointer */
       p->payload = (u8_t *)p->payload - header_size_increment;
+    } else if ((header_size_increment > 0) && (p->flags & PBUF_FLAG_PAGE) &&
+               (increment_magnitude <= (mem_ptr_t)p->payload % PBUF_PAGE_SIZE)) {
+      /* uncover a header earlier in the same page */
+      p->payload = (u8_t *)p->payload - header_size_increment;
     } else {
       /* cannot expand payload to front (yet!)
        * bail out unsuccesfully */
@@ -500,6 +504,12 @@ pbuf_free(struct pbuf *p)
         memp_free(MEMP_PBUF_POOL, p);
       /* is this a ROM or RAM referencing pbuf? */
       } else if (type == PBUF_ROM || type == PBUF_REF) {
+        if (p->flags & PBUF_FLAG_PAGE) {
+          pbuf_page_free(p);
+        }
+        if (p->flags & PBUF_FLAG_SENDREF) {
+          pbuf_sendref_free(p);
+        }
         memp_free(MEMP_PBUF, p);
       /* type == PBUF_RAM */
       } else {
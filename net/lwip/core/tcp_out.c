@@ -253,6 +253,8 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
       /* reference the non-volatile payload data */
       p->payload = ptr;
       seg->dataptr = ptr;
+      /* JOS: count the pbuf if it refers to data of lwip_send_ref() */
+      pbuf_sendref_hold(p);
 
       /* Second, allocate a pbuf for the headers. */
       if ((seg->p = pbuf_alloc(PBUF_TRANSPORT, 0, PBUF_RAM)) == NULL) {
@@ -60,6 +60,14 @@ typedef enum {
 
 /** indicates this packet's data should be immediately passed to the application */
 #define PBUF_FLAG_PUSH 0x01U
+/** the payload of this PBUF_REF pbuf lies in a page lent by the port,
+ * which gets it back through pbuf_page_free(); headers may be added in
+ * front of the payload as long as they stay within that page */
+#define PBUF_FLAG_PAGE 0x02U
+/** the payload of this PBUF_ROM pbuf is data passed to lwip_send_ref(),
+ * which is told through pbuf_sendref_free() when the pbuf goes away */
+#define PBUF_FLAG_SENDREF 0x04U
+#define PBUF_PAGE_SIZE 4096
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -104,6 +112,11 @@ u8_t pbuf_header(struct pbuf *p, s16_t header_size);
 void pbuf_ref(struct pbuf *p);
 void pbuf_ref_chain(struct pbuf *p);
 u8_t pbuf_free(struct pbuf *p);
+/* provided by the port when it lends pages with PBUF_FLAG_PAGE */
+void pbuf_page_free(struct pbuf *p);
+/* provided by api/sockets.c for the data of lwip_send_ref() */
+void pbuf_sendref_hold(struct pbuf *p);
+void pbuf_sendref_free(struct pbuf *p);
 u8_t pbuf_clen(struct pbuf *p);  
 void pbuf_cat(struct pbuf *head, struct pbuf *tail);
 void pbuf_chain(struct pbuf *head, struct pbuf *tail);
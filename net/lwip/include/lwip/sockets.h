@@ -314,6 +314,8 @@ int lwip_read(int s, void *mem, int len);
 int lwip_recvfrom(int s, void *mem, int len, unsigned int flags,
       struct sockaddr *from, socklen_t *fromlen);
 int lwip_send(int s, const void *dataptr, int size, unsigned int flags);
+int lwip_send_ref(int s, const void *dataptr, int size, unsigned int flags, void **ref);
+void lwip_send_ref_wait(void *ref);
 int lwip_sendto(int s, const void *dataptr, int size, unsigned int flags,
     struct sockaddr *to, socklen_t tolen);
 int lwip_socket(int domain, int type, int protocol);
@@ -181,7 +181,7 @@ sys_arch_sem_wait(sys_sem_t sem, u32_t tm_msec)
  	} else if (tm_msec == SYS_ARCH_NOWAIT) {
 	    return SYS_ARCH_TIMEOUT;
 	} else {
-	    uint32_t a = sys_time_msec();
+	    uint32_t a = time_msec();
 	    uint32_t sleep_until = tm_msec ? a + (tm_msec - waited) : ~0;
 	    sems[sem].waiters = 1;
 	    uint32_t cur_v = sems[sem].v;
@@ -192,7 +192,7 @@ sys_arch_sem_wait(sys_sem_t sem, u32_t tm_msec)
 		cprintf("sys_arch_sem_wait: sem freed under waiter!\n");
 		return SYS_ARCH_TIMEOUT;
 	    }
-	    uint32_t b = sys_time_msec();
+	    uint32_t b = time_msec();
 	    waited += (b - a);
 	}
     }
@@ -258,8 +258,12 @@ sys_thread_new(char *name, void (* thread)(void *arg), void *arg,
     lt->func = thread;
     lt->arg = arg;
 
+    // lwIP's priorities are ours; see TCPIP_THREAD_PRIO in lwipopts.h
+    if (prio < 0 || prio >= THREAD_NPRIO)
+	prio = THREAD_PRIO_NORMAL;
+
     thread_id_t tid;
-    int r = thread_create(&tid, name, lwip_thread_entry, (uint32_t)lt);
+    int r = thread_create(&tid, name, lwip_thread_entry, (uint32_t)lt, prio);
 
     if (r < 0)
 	panic("lwip: sys_thread_new: cannot create: %s\n", e2s(r));
@@ -7,12 +7,32 @@
 static thread_id_t max_tid;
 static struct thread_context *cur_tc;
 
-static struct thread_queue thread_queue;
+// Runnable threads, one FIFO per priority.  The running thread is on
+// none of them.
+static struct thread_queue run_queue[THREAD_NPRIO];
 static struct thread_queue kill_queue;
 
+// Threads in thread_wait for an address are on the wait_hash chain
+// for that address; threads whose wait has a time limit are on
+// sleepers too, soonest first.
+enum { wait_hash_size = 64 };
+static LIST_HEAD(wait_list, thread_context) wait_hash[wait_hash_size];
+static struct wait_list sleepers;
+
+#define WAIT_HASH(addr)	((((uintptr_t) (addr)) >> 2) % wait_hash_size)
+
+static void thread_switch(void);
+
 void
 thread_init(void) {
-    threadq_init(&thread_queue);
+    int i;
+
+    for (i = 0; i < THREAD_NPRIO; i++)
+	threadq_init(&run_queue[i]);
+    threadq_init(&kill_queue);
+    for (i = 0; i < wait_hash_size; i++)
+	LIST_INIT(&wait_hash[i]);
+    LIST_INIT(&sleepers);
     max_tid = 0;
 }
 
@@ -21,38 +41,82 @@ thread_id(void) {
     return cur_tc->tc_tid;
 }
 
+// End tc's wait, if any, and queue it to run.
+static void
+thread_ready(struct thread_context *tc) {
+    if (tc->tc_wait_addr) {
+	LIST_REMOVE(tc, tc_wait_link);
+	tc->tc_wait_addr = 0;
+    }
+    if (tc->tc_wait_until != (uint32_t) ~0) {
+	LIST_REMOVE(tc, tc_sleep_link);
+	tc->tc_wait_until = ~0;
+    }
+    threadq_push(&run_queue[tc->tc_prio], tc);
+}
+
 void
 thread_wakeup(volatile uint32_t *addr) {
-    struct thread_context *tc = thread_queue.tq_first;
-    while (tc) {
+    struct thread_context *tc, *next;
+
+    for (tc = LIST_FIRST(&wait_hash[WAIT_HASH(addr)]); tc; tc = next) {
+	next = LIST_NEXT(tc, tc_wait_link);
 	if (tc->tc_wait_addr == addr)
-	    tc->tc_wakeup = 1;
-	tc = tc->tc_queue_link;
+	    thread_ready(tc);
     }
 }
 
+// Wait until thread_wakeup(addr), if addr is not null, or until time
+// 'msec' (as time_msec; ~0 for no limit), whichever comes first.
+// Does not wait at all if *addr is no longer 'val'.
 void
 thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
-    uint32_t s = sys_time_msec();
-    uint32_t p = s;
-
-    cur_tc->tc_wait_addr = addr;
-    cur_tc->tc_wakeup = 0;
-
-    while (p < msec) {
-	if (p < s)
-	    break;
-	if (addr && *addr != val)
-	    break;
-	if (cur_tc->tc_wakeup)
-	    break;
-
-	thread_yield();
-	p = sys_time_msec();
+    struct thread_context *tc;
+
+    // outside any thread there is nothing to switch to
+    if (!cur_tc)
+	return;
+    if (addr && *addr != val)
+	return;
+    if (msec != (uint32_t) ~0 && msec <= time_msec())
+	return;
+
+    if (addr) {
+	cur_tc->tc_wait_addr = addr;
+	LIST_INSERT_HEAD(&wait_hash[WAIT_HASH(addr)], cur_tc, tc_wait_link);
+    }
+    if (msec != (uint32_t) ~0) {
+	cur_tc->tc_wait_until = msec;
+	tc = LIST_FIRST(&sleepers);
+	if (!tc || msec < tc->tc_wait_until)
+	    LIST_INSERT_HEAD(&sleepers, cur_tc, tc_sleep_link);
+	else {
+	    while (LIST_NEXT(tc, tc_sleep_link)
+		   && LIST_NEXT(tc, tc_sleep_link)->tc_wait_until <= msec)
+		tc = LIST_NEXT(tc, tc_sleep_link);
+	    LIST_INSERT_AFTER(tc, cur_tc, tc_sleep_link);
+	}
     }
 
-    cur_tc->tc_wait_addr = 0;
-    cur_tc->tc_wakeup = 0;
+    // thread_ready puts us back on a run queue
+    thread_switch();
+}
+
+// Return the time, as time_msec, by which some other thread needs
+// to run: 0 if one can run now, or the end of the earliest timed wait,
+// or ~0 if every thread waits without a time limit.  A thread that
+// would otherwise block the environment, say in ipc_recv_timed, can
+// block until then instead of yielding in a loop.
+uint32_t
+thread_wait_until(void) {
+    int i;
+
+    for (i = 0; i < THREAD_NPRIO; i++)
+	if (run_queue[i].tq_first)
+	    return 0;
+    if (!LIST_EMPTY(&sleepers))
+	return LIST_FIRST(&sleepers)->tc_wait_until;
+    return ~0;
 }
 
 int
@@ -87,7 +151,7 @@ thread_entry(void) {
 
 int
 thread_create(thread_id_t *tid, const char *name, 
-		void (*entry)(uint32_t), uint32_t arg) {
+		void (*entry)(uint32_t), uint32_t arg, int prio) {
     struct thread_context *tc = malloc(sizeof(struct thread_context));
     if (!tc)
 	return -E_NO_MEM;
@@ -113,8 +177,10 @@ thread_create(thread_id_t *tid, const char *name,
     tc->tc_jb.jb_eip = (uint32_t)&thread_entry;
     tc->tc_entry = entry;
     tc->tc_arg = arg;
+    tc->tc_prio = prio;
+    tc->tc_wait_until = ~0;
 
-    threadq_push(&thread_queue, tc);
+    threadq_push(&run_queue[prio], tc);
 
     if (tid)
 	*tid = tc->tc_tid;
@@ -140,25 +206,61 @@ thread_halt() {
 
     threadq_push(&kill_queue, cur_tc);
     cur_tc = NULL;
-    thread_yield();
-    // WHAT IF THERE ARE NO MORE THREADS? HOW DO WE STOP?
-    // when yield has no thread to run, it will return here!
+    thread_switch();
+    // thread_switch returns only when no thread is left to run
     exit();
 }
 
 void
 thread_yield(void) {
-    struct thread_context *next_tc = threadq_pop(&thread_queue);
+    if (cur_tc)
+	threadq_push(&run_queue[cur_tc->tc_prio], cur_tc);
+    thread_switch();
+}
 
-    if (!next_tc)
-	return;
+// Return the first thread of the highest priority that can run,
+// after readying the threads whose waits have timed out.
+static struct thread_context *
+thread_pick(void) {
+    struct thread_context *tc;
+    uint32_t now;
+    int i;
 
-    if (cur_tc) {
-	if (jos_setjmp(&cur_tc->tc_jb) != 0)
+    if (!LIST_EMPTY(&sleepers)) {
+	now = time_msec();
+	while ((tc = LIST_FIRST(&sleepers)) && tc->tc_wait_until <= now)
+	    thread_ready(tc);
+    }
+    for (i = 0; i < THREAD_NPRIO; i++)
+	if ((tc = threadq_pop(&run_queue[i])))
+	    return tc;
+    return 0;
+}
+
+// Run the next thread.  The current thread, if any, must already be
+// on a run queue or waiting.  Returns to it when it is picked again,
+// or at once if no thread will ever run.
+static void
+thread_switch(void) {
+    struct thread_context *next_tc;
+
+    while (!(next_tc = thread_pick())) {
+	if (LIST_EMPTY(&sleepers)) {
+	    if (cur_tc)
+		panic("thread_switch: %s waits, but no thread can run",
+		      cur_tc->tc_name);
 	    return;
-	threadq_push(&thread_queue, cur_tc);
+	}
+	// only timed waits are left; sleep until the first ends, without
+	// taking messages meant for the thread that receives them
+	sys_time_sleep(LIST_FIRST(&sleepers)->tc_wait_until);
     }
 
+    if (next_tc == cur_tc)
+	return;
+    if (cur_tc && jos_setjmp(&cur_tc->tc_jb) != 0)
+	return;
+
     cur_tc = next_tc;
     jos_longjmp(&cur_tc->tc_jb, 1);
 }
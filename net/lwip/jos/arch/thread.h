@@ -5,13 +5,23 @@
 
 typedef uint32_t thread_id_t;
 
+// A thread runs only while no thread of a higher priority (a lower
+// number) can.  Packet processing and timers run at THREAD_PRIO_HIGH,
+// ahead of the threads serving socket requests.
+enum {
+    THREAD_PRIO_HIGH = 0,
+    THREAD_PRIO_NORMAL,
+    THREAD_NPRIO
+};
+
 void thread_init(void);
 thread_id_t thread_id(void);
 void thread_wakeup(volatile uint32_t *addr);
 void thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec);
+uint32_t thread_wait_until(void);
 int thread_onhalt(void (*fun)(thread_id_t));
 int thread_create(thread_id_t *tid, const char *name, 
-		void (*entry)(uint32_t), uint32_t arg);
+		void (*entry)(uint32_t), uint32_t arg, int prio);
 void thread_yield(void);
 void thread_halt(void);
 
@@ -1,6 +1,7 @@
 #ifndef JOS_INC_THREADQ_H
 #define JOS_INC_THREADQ_H
 
+#include <inc/queue.h>
 #include <arch/thread.h>
 #include <arch/setjmp.h>
 
@@ -23,8 +24,11 @@ struct thread_context {
     void		(*tc_entry)(uint32_t);
     uint32_t		tc_arg;
     struct jos_jmp_buf	tc_jb;
-    volatile uint32_t	*tc_wait_addr;
-    volatile char	tc_wakeup;
+    int			tc_prio;	// THREAD_PRIO_*
+    volatile uint32_t	*tc_wait_addr;	// if set, on a wait_hash chain
+    uint32_t		tc_wait_until;	// if not ~0, on the sleepers list
+    LIST_ENTRY(thread_context) tc_wait_link;
+    LIST_ENTRY(thread_context) tc_sleep_link;
     void		(*tc_onhalt[THREAD_NUM_ONHALT])(thread_id_t);
     int			tc_nonhalt;
     struct thread_context *tc_queue_link;
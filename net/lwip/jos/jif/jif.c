@@ -44,13 +44,29 @@
 
 #include <netif/etharp.h>
 
-#define PKTMAP		0x10000000
+/*
+ * Receive buffers are pages at RXMAP.  Up to RXRING of them are posted
+ * to the driver at a time, in order, and each is handed to lwIP in
+ * place once the driver fills it; see low_level_input.  A page comes
+ * back to the free list when lwIP frees its pbuf, and is posted again
+ * without being unmapped.
+ */
+#define RXMAP		0x10000000
+#define RXPAGES		192
+#define RXRING		64
 
 struct jif {
     struct eth_addr *ethaddr;
-    envid_t envid;
 };
 
+static void jif_rx_fill(void);
+
+static struct jif_pkt *rxfree[RXPAGES];
+static int rxnfree;
+static struct jif_pkt *rxring[RXRING];
+static int rxhead;
+static int rxtail;
+
 static void
 low_level_init(struct netif *netif)
 {
@@ -76,38 +92,103 @@ low_level_init(struct netif *netif)
  * contained in the pbuf that is passed to the function. This pbuf
  * might be chained.
  *
+ * The chain is handed to the driver as a list of fragments, split at
+ * page boundaries.  PBUF_ROM payloads are the pages of sockets' send
+ * buffers, which lwIP keeps until they are acknowledged, so the NIC
+ * reads them in place; the kernel copies everything else.  A chain
+ * with too many fragments is flattened into txbuf first.
+ *
  */
+#define TXFRAGS		16
+
+static char txbuf[2000];
+
 static err_t
 low_level_output(struct netif *netif, struct pbuf *p)
 {
-    int r = sys_page_alloc(0, (void *)PKTMAP, PTE_U|PTE_W|PTE_P);
-    if (r < 0)
-	panic("jif: could not allocate page of memory");
-    struct jif_pkt *pkt = (struct jif_pkt *)PKTMAP;
-
-    struct jif *jif;
-    jif = netif->state;
-
-    char *txbuf = pkt->jp_data;
-    int txsize = 0;
+    void *bufs[TXFRAGS];
+    unsigned int sizes[TXFRAGS];
     struct pbuf *q;
+    char *va;
+    int n = 0, r, off, len;
+
     for (q = p; q != NULL; q = q->next) {
-	/* Send the data from the pbuf to the interface, one pbuf at a
-	   time. The size of the data in each pbuf is kept in the ->len
-	   variable. */
-
-	if (txsize + q->len > 2000)
-	    panic("oversized packet, fragment %d txsize %d\n", q->len, txsize);
-	memcpy(&txbuf[txsize], q->payload, q->len);
-	txsize += q->len;
+	for (off = 0; off < q->len; off += len) {
+	    va = (char *) q->payload + off;
+	    len = MIN(q->len - off, PGSIZE - (int) ((uintptr_t) va % PGSIZE));
+	    if (n == TXFRAGS)
+		goto flatten;
+	    bufs[n] = va;
+	    sizes[n] = len | (q->type == PBUF_ROM ? 0 : NETBUF_COPY);
+	    n++;
+	}
     }
 
-    pkt->jp_len = txsize;
+ send:
+    /* the ring drains as the interrupts for sent frames come in */
+    while ((r = sys_net_txfrags(bufs, sizes, n)) == -E_NO_MEM)
+	sys_yield();
+    if (r < 0 && n > 2)
+	goto flatten;
+    if (r < 0) {
+	cprintf("jif: could not transmit: %e\n", r);
+	return ERR_IF;
+    }
+    return ERR_OK;
 
-    ipc_send(jif->envid, NSREQ_OUTPUT, (void *)pkt, PTE_P|PTE_W|PTE_U);
-    sys_page_unmap(0, (void *)pkt);
+ flatten:
+    if (p->tot_len > sizeof(txbuf))
+	panic("oversized packet, txsize %d\n", p->tot_len);
+    pbuf_copy_partial(p, txbuf, p->tot_len, 0);
+    n = 0;
+    for (off = 0; off < p->tot_len; off += len) {
+	va = txbuf + off;
+	len = MIN(p->tot_len - off, PGSIZE - (int) ((uintptr_t) va % PGSIZE));
+	bufs[n] = va;
+	sizes[n] = len | NETBUF_COPY;
+	n++;
+    }
+    goto send;
+}
 
-    return ERR_OK;
+/*
+ * Give lwIP's pages back to the receive buffer free list.
+ */
+void
+pbuf_page_free(struct pbuf *p)
+{
+    rxfree[rxnfree++] = ROUNDDOWN(p->payload, PGSIZE);
+    /* with the ring empty no packet arrives to trigger a refill */
+    if (rxhead == rxtail)
+	jif_rx_fill();
+}
+
+/*
+ * Post every free page the ring has room for, in one system call.
+ */
+static void
+jif_rx_fill(void)
+{
+    void *bufs[RXRING];
+    unsigned int sizes[RXRING];
+    struct jif_pkt *pkt;
+    int i, n, r;
+
+    for (n = 0; rxhead + n - rxtail < RXRING && rxnfree > 0; n++) {
+	pkt = rxfree[--rxnfree];
+	/* the driver marks the buffer filled by storing its length */
+	pkt->jp_len = 0;
+	bufs[n] = pkt;
+	sizes[n] = PGSIZE;
+    }
+    if (n == 0)
+	return;
+
+    if ((r = sys_net_rxbufs(bufs, sizes, n)) < 0)
+	panic("jif: could not post receive buffers: %e", r);
+    for (i = 0; i < n; i++)
+	rxring[(rxhead + i) % RXRING] = bufs[i];
+    rxhead += n;
 }
 
 /*
@@ -116,16 +197,32 @@ low_level_output(struct netif *netif, struct pbuf *p)
  * Should allocate a pbuf and transfer the bytes of the incoming
  * packet from the interface into the pbuf.
  *
+ * The pbuf refers to the packet where it lies, in its receive page,
+ * which lwIP gives back through pbuf_page_free.  If no pbuf is free
+ * for that, or lwIP already holds so many pages that the ring could
+ * not be refilled, the packet is copied and the page goes straight
+ * back.
+ *
  */
 static struct pbuf *
-low_level_input(void *va)
+low_level_input(struct jif_pkt *pkt)
 {
-    struct jif_pkt *pkt = (struct jif_pkt *)va;
     s16_t len = pkt->jp_len;
 
-    struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
-    if (p == 0)
+    struct pbuf *p = 0;
+    if (rxnfree >= RXRING / 2)
+	p = pbuf_alloc(PBUF_RAW, len, PBUF_REF);
+    if (p) {
+	p->payload = pkt->jp_data;
+	p->flags |= PBUF_FLAG_PAGE;
+	return p;
+    }
+
+    p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+    if (p == 0) {
+	rxfree[rxnfree++] = pkt;
 	return 0;
+    }
 
     /* We iterate over the pbuf chain until we have read the entire
      * packet into the pbuf. */
@@ -143,8 +240,10 @@ low_level_input(void *va)
 	copied += bytes;
     }
 
+    rxfree[rxnfree++] = pkt;
     return p;
 }
+
 /*
  * jif_output():
  *
@@ -163,7 +262,7 @@ jif_output(struct netif *netif, struct pbuf *p,
 }
 
 /*
- * jif_input():
+ * jif_input_pkt():
  *
  * This function should be called when a packet is ready to be read
  * from the interface. It uses the function low_level_input() that
@@ -172,8 +271,8 @@ jif_output(struct netif *netif, struct pbuf *p,
  *
  */
 
-void
-jif_input(struct netif *netif, void *va)
+static void
+jif_input_pkt(struct netif *netif, struct jif_pkt *pkt)
 {
     struct jif *jif;
     struct eth_hdr *ethhdr;
@@ -181,8 +280,8 @@ jif_input(struct netif *netif, void *va)
 
     jif = netif->state;
   
-    /* move received packet into a new pbuf */
-    p = low_level_input(va);
+    /* wrap the received packet in a pbuf */
+    p = low_level_input(pkt);
 
     /* no packet could be read, silently ignore this */
     if (p == NULL) return;
@@ -209,6 +308,32 @@ jif_input(struct netif *netif, void *va)
     }
 }
 
+/*
+ * jif_input():
+ *
+ * Called when the driver has told us that packets have arrived.
+ * Passes every filled receive buffer to lwIP, in order, then posts
+ * free pages in their place.
+ *
+ */
+
+void
+jif_input(struct netif *netif)
+{
+    struct jif_pkt *pkt;
+
+    for (; rxtail != rxhead; rxtail++) {
+	pkt = rxring[rxtail % RXRING];
+	if (*(volatile int *) &pkt->jp_len == 0)
+	    break;
+	if (pkt->jp_len > 0)
+	    jif_input_pkt(netif, pkt);
+	else
+	    rxfree[rxnfree++] = pkt;
+    }
+    jif_rx_fill();
+}
+
 /*
  * jif_init():
  *
@@ -222,7 +347,7 @@ err_t
 jif_init(struct netif *netif)
 {
     struct jif *jif;
-    envid_t *output_envid; 
+    int i, r;
 
     jif = mem_malloc(sizeof(struct jif));
 
@@ -231,18 +356,25 @@ jif_init(struct netif *netif)
 	return ERR_MEM;
     }
 
-    output_envid = (envid_t *)netif->state;
-
     netif->state = jif;
     netif->output = jif_output;
     netif->linkoutput = low_level_output;
     memcpy(&netif->name[0], "en", 2);
 
     jif->ethaddr = (struct eth_addr *)&(netif->hwaddr[0]);
-    jif->envid = *output_envid; 
 
     low_level_init(netif);
 
+    for (i = 0; i < RXPAGES; i++) {
+	rxfree[i] = (struct jif_pkt *) (RXMAP + (RXPAGES - 1 - i) * PGSIZE);
+	if ((r = sys_page_alloc(0, rxfree[i], PTE_P|PTE_W|PTE_U)) < 0)
+	    panic("jif: could not allocate receive buffers: %e", r);
+    }
+    rxnfree = RXPAGES;
+    jif_rx_fill();
+    if ((r = sys_net_rxnotify(NSREQ_INPUT)) < 0)
+	panic("jif: could not ask for receive notifications: %e", r);
+
     etharp_init();
 
     // qemu user-net is dumb; if the host OS does not send and ARP request
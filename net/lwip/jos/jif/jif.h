@@ -1,4 +1,4 @@
 #include <lwip/netif.h>
 
-void	jif_input(struct netif *netif, void *va);
+void	jif_input(struct netif *netif);
 err_t	jif_init(struct netif *netif);
@@ -17,12 +17,18 @@ void *memcpy(void *dst, const void *src, size_t n);
 //#define SYS_LIGHTWEIGHT_PROT	1
 #define LWIP_PROVIDE_ERRNO      1
 
+// The tcpip thread carries out the lwIP calls that the threads serving
+// socket requests hand it, so it runs ahead of them (THREAD_PRIO_HIGH
+// in arch/thread.h).  Incoming packets do not go through it: jif_input
+// passes them to ip_input in ns's input thread, also THREAD_PRIO_HIGH.
+#define TCPIP_THREAD_PRIO	0
+
 // Various tuning knobs, see:
 // http://lists.gnu.org/archive/html/lwip-users/2006-11/msg00007.html
 
 #define MEM_ALIGNMENT		4
 
-#define MEMP_NUM_PBUF		64
+#define MEMP_NUM_PBUF		192	// includes one per page lent by jif
 #define MEMP_NUM_UDP_PCB	8
 #define MEMP_NUM_TCP_PCB	32
 #define MEMP_NUM_TCP_PCB_LISTEN	16
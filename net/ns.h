@@ -5,18 +5,10 @@
 #define MASK "255.255.255.0"
 #define DEFAULT "10.0.2.2"
 
-#define TIMER_INTERVAL 250
-
 // Virtual address at which to receive page mappings containing client requests.
+// Each of the QUEUE_SIZE slots holds a request page and the data pages
+// that may follow it.
 #define QUEUE_SIZE	20
-#define REQVA		(0x0ffff000 - QUEUE_SIZE * PGSIZE)
-
-/* timer.c */
-void timer(envid_t ns_envid, uint32_t initial_to);
-
-/* input.c */
-void input(envid_t ns_envid);
-
-/* output.c */
-void output(envid_t ns_envid);
+#define SLOTPAGES	(1 + NSREQ_MAXDATA)
+#define REQVA		(0x0ffff000 - QUEUE_SIZE * SLOTPAGES * PGSIZE)
 
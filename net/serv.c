@@ -43,9 +43,6 @@ static struct timer_thread t_arp;
 static struct timer_thread t_tcpf;
 static struct timer_thread t_tcps;
 
-static envid_t timer_envid;
-static envid_t input_envid;
-static envid_t output_envid;
 
 static bool buse[QUEUE_SIZE];
 static int next_i(int i) { return (i+1) % QUEUE_SIZE; }
@@ -64,7 +61,7 @@ get_buffer() {
 	return 0;
     }
 
-    va = (void *)(REQVA + i * PGSIZE);
+    va = (void *)(REQVA + i * SLOTPAGES * PGSIZE);
     buse[i] = 1;
     
     return va;
@@ -72,7 +69,7 @@ get_buffer() {
 
 static void
 put_buffer(void *va) {
-    int i = ((uint32_t)va - REQVA) / PGSIZE;
+    int i = ((uint32_t)va - REQVA) / (SLOTPAGES * PGSIZE);
     buse[i] = 0;
 }
 
@@ -101,7 +98,7 @@ net_timer(uint32_t arg)
     struct timer_thread *t = (struct timer_thread *) arg;
 
     for (;;) {
-	uint32_t cur = sys_time_msec();
+	uint32_t cur = time_msec();
 
 	lwip_core_lock();
 	t->func();
@@ -111,13 +108,32 @@ net_timer(uint32_t arg)
     }
 }
 
+// Set by the dispatcher when the kernel says packets are waiting.
+static volatile uint32_t input_pending;
+
+// Packet input runs at THREAD_PRIO_HIGH, with the lwIP timers, ahead
+// of the threads serving socket requests.
+static void __attribute__((noreturn))
+net_input(uint32_t arg)
+{
+    for (;;) {
+	thread_wait(&input_pending, 0, (uint32_t)~0);
+	input_pending = 0;
+
+	lwip_core_lock();
+	jif_input(&nif);
+	lwip_core_unlock();
+    }
+}
+
 static void
 start_timer(struct timer_thread *t, void (*func)(void), const char *name, int msec)
 {
     t->msec = msec;
     t->func = func;
     t->name = name;
-    int r = thread_create(0, name, &net_timer, (uint32_t)t);
+    int r = thread_create(0, name, &net_timer, (uint32_t)t,
+			  THREAD_PRIO_HIGH);
     if (r < 0)
 	panic("cannot create timer thread: %s", e2s(r));
 }
@@ -142,12 +158,16 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
     thread_wait(&done, 0, (uint32_t)~0);
     lwip_core_lock();
 
-    lwip_init(&nif, &output_envid, ipaddr, netmask, gw);
+    lwip_init(&nif, 0, ipaddr, netmask, gw);
 
     start_timer(&t_arp, &etharp_tmr, "arp timer", ARP_TMR_INTERVAL);
     start_timer(&t_tcpf, &tcp_fasttmr, "tcp f timer", TCP_FAST_INTERVAL);
     start_timer(&t_tcps, &tcp_slowtmr, "tcp s timer", TCP_SLOW_INTERVAL);
 
+    r = thread_create(0, "net input", &net_input, 0, THREAD_PRIO_HIGH);
+    if (r < 0)
+	panic("cannot create input thread: %s", e2s(r));
+
     struct in_addr ia = {ipaddr};
     cprintf("ns: %02x:%02x:%02x:%02x:%02x:%02x" 
 	    " bound to static IP %s\n", 
@@ -160,6 +180,16 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
     cprintf("NS: TCP/IP initialized.\n");
 }
 
+// lwIP fails a non-blocking call that would block with EWOULDBLOCK;
+// tell the client with -E_WOULD_BLOCK.  Report any other failure.
+static int
+sock_result(int r, const char *what) {
+    if (r < 0 && errno == EWOULDBLOCK)
+	return -E_WOULD_BLOCK;
+    if (r < 0) perror(what);
+    return r;
+}
+
 static void
 serve_accept(envid_t envid, struct Nsreq_accept* rq) {
     int r;
@@ -169,8 +199,8 @@ serve_accept(envid_t envid, struct Nsreq_accept* rq) {
     sys_page_alloc(0, buf, PTE_P|PTE_W|PTE_U);
 
     ret = (struct Nsret_accept*)buf;
-    r = lwip_accept(rq->req_s, &ret->ret_addr, &ret->ret_addrlen);
-    if (r < 0) perror("serve_accept");
+    r = sock_result(lwip_accept(rq->req_s, &ret->ret_addr, &ret->ret_addrlen),
+		    "serve_accept");
 
     ipc_send(envid, r, ret, PTE_P|PTE_W|PTE_U);
     sys_page_unmap(0, buf);
@@ -212,65 +242,141 @@ serve_listen(envid_t envid, struct Nsreq_listen* rq) {
     ipc_send(envid, r, 0, 0);
 }
 
+// Receive into fresh pages after the request page, in the request's
+// slot, and send back as many of them as the data fills.
 static void
 serve_recv(envid_t envid, struct Nsreq_recv* rq) {
-    int r;
-    void *mem;
-    extern uint8_t nsipcbuf[PGSIZE];	// page-aligned, declared in entry.S
+    int r = 0, len, i, n;
+    char *mem = (char *)rq + PGSIZE;
+    void *pgs[NSREQ_MAXDATA];
+
+    // lwip_recvfrom counts the bytes it copies in a u16_t
+    len = MIN(rq->req_len, MIN(NSREQ_MAXDATA * PGSIZE, 0xFFFF));
+    n = ROUNDUP(MAX(len, 0), PGSIZE) / PGSIZE;
+    for (i = 0; i < n; i++) {
+	pgs[i] = mem + i * PGSIZE;
+	if ((r = sys_page_alloc(0, pgs[i], PTE_P|PTE_W|PTE_U)) < 0)
+	    break;
+    }
 
-    mem = (void *)nsipcbuf;
-    r = lwip_recv(rq->req_s, mem, rq->req_len, rq->req_flags);
-    if (r < 0) perror("serve_recv");
+    if (i == n) {
+	r = sock_result(lwip_recv(rq->req_s, mem, len, rq->req_flags), "serve_recv");
+    }
+    if (r > 0)
+	ipc_send_pages(envid, r, pgs, ROUNDUP(r, PGSIZE) / PGSIZE, PTE_P|PTE_W|PTE_U);
+    else
+	ipc_send(envid, r, 0, 0);
 
-    ipc_send(envid, r, mem, PTE_P|PTE_W|PTE_U);
+    while (--i >= 0)
+	sys_page_unmap(0, pgs[i]);
 }
 
 static void
 serve_send(envid_t envid, struct Nsreq_send* rq) {
-    int r = lwip_send(rq->req_s, &rq->req_dataptr, rq->req_size, rq->req_flags);
-    if (r < 0) perror("serve_send");
+    int r = sock_result(lwip_send(rq->req_s, &rq->req_dataptr, rq->req_size, rq->req_flags),
+			"serve_send");
     ipc_send(envid, r, 0, 0);
 }
 
-static void
-serve_socket(envid_t envid, struct Nsreq_socket *rq) {
-    int r = lwip_socket(rq->req_domain, rq->req_type, rq->req_protocol);
-    if (r < 0) perror("serve_socket");
-    ipc_send(envid, r, 0, 0);
-}
+// Send data straight from the pages that follow the request page.
+// lwIP refers to them until the peer has acknowledged the data, so
+// the slot is only given back after that.  For sendfile the client
+// can go on as soon as the data is queued; pages of the client's own
+// memory must not change under lwIP, so 'wait' holds the reply too.
+// Only MAXSENDPAGES such requests may hold slots at once, so a slow
+// peer cannot use up every slot and leave none for new requests; past
+// that, the data is copied, as for NSREQ_SEND, and the slot is given
+// back as soon as lwIP has taken it.  MAXSENDPAGES must not exceed
+// LWIP_SEND_REFS in lwIP's api/sockets.c.
+#define MAXSENDPAGES	(QUEUE_SIZE / 2)
+static int nsendpages;
 
 static void
-process_timer(envid_t envid) {
-    uint32_t start, now, to;
+serve_sendpages(envid_t envid, struct Nsreq_sendpages *rq, size_t npages, bool wait) {
+    int r;
+    void *ref;
+    char *data = (char *)rq + PGSIZE + rq->req_offset;
 
-    if (envid != timer_envid) {
-	cprintf("NS: received timer interrupt from envid %x not timer env\n", envid);
+    if (rq->req_offset < 0 || rq->req_offset >= PGSIZE || rq->req_size < 0
+	|| npages < 1 || (npages - 1) * PGSIZE < (uint32_t)rq->req_offset
+	|| (uint32_t)rq->req_size > (npages - 1) * PGSIZE - (uint32_t)rq->req_offset) {
+	ipc_send(envid, -E_INVAL, 0, 0);
+	return;
+    }
+    if (nsendpages >= MAXSENDPAGES) {
+	r = sock_result(lwip_send(rq->req_s, data, rq->req_size, rq->req_flags),
+			"serve_sendpages");
+	ipc_send(envid, r, 0, 0);
 	return;
     }
 
-    start = sys_time_msec();
-    thread_yield();
-    now = sys_time_msec();
+    nsendpages++;
+    r = sock_result(lwip_send_ref(rq->req_s, data, rq->req_size, rq->req_flags, &ref),
+		    "serve_sendpages");
+    if (!wait)
+	ipc_send(envid, r, 0, 0);
+    if (ref)
+	lwip_send_ref_wait(ref);
+    if (wait)
+	ipc_send(envid, r, 0, 0);
+    nsendpages--;
+}
 
-    to = TIMER_INTERVAL - (now - start);
-    ipc_send(envid, to, 0, 0);
+static void
+serve_ioctl(envid_t envid, struct Nsreq_ioctl *rq) {
+    int r;
+    u16_t avail = 0;
+
+    switch (rq->req_cmd) {
+    case FIONBIO:
+	r = lwip_ioctl(rq->req_s, FIONBIO, &rq->req_arg);
+	break;
+    case FIONREAD:
+	r = lwip_ioctl(rq->req_s, FIONREAD, &avail);
+	rq->req_arg = avail;
+	break;
+    default:
+	r = -E_INVAL;
+	break;
+    }
+    if (r == -1) perror("serve_ioctl");
+    ipc_send(envid, r, rq, PTE_P|PTE_W|PTE_U);
 }
 
+// Wait in lwip_select, in this request's own thread, until one of the
+// sockets is ready or the timeout passes.
 static void
-net_recv(envid_t envid, struct jif_pkt* pkt) {
-    jif_input(&nif, (void *)pkt);
-    sys_page_unmap(0, (void*)pkt);
+serve_select(envid_t envid, struct Nsreq_select *rq) {
+    int r;
+
+    if (rq->req_nfds < 0 || rq->req_nfds > FD_SETSIZE)
+	r = -E_INVAL;
+    else
+	r = sock_result(lwip_select(rq->req_nfds, &rq->req_readset, &rq->req_writeset,
+				    &rq->req_exceptset,
+				    rq->req_hastimeout ? &rq->req_timeout : 0),
+			"serve_select");
+    ipc_send(envid, r, rq, PTE_P|PTE_W|PTE_U);
+}
+
+static void
+serve_socket(envid_t envid, struct Nsreq_socket *rq) {
+    int r = lwip_socket(rq->req_domain, rq->req_type, rq->req_protocol);
+    if (r < 0) perror("serve_socket");
+    ipc_send(envid, r, 0, 0);
 }
 
 struct st_args {
 	int32_t req;
 	uint32_t whom;
 	void *va;
+	size_t npages;
 };
 
 static void
 serve_thread(uint32_t a) {
 	struct st_args *args = (struct st_args *)a;
+	size_t i;
 
 	switch (args->req) {
 	  case NSREQ_ACCEPT:
@@ -300,16 +406,26 @@ serve_thread(uint32_t a) {
 	  case NSREQ_SOCKET:
 		serve_socket(args->whom, (struct Nsreq_socket*)args->va);
 		break;
-	  case NSREQ_INPUT:
-		net_recv(args->whom, (struct jif_pkt*)args->va);
+	  case NSREQ_SENDFILE:
+		serve_sendpages(args->whom, (struct Nsreq_sendpages*)args->va, args->npages, 0);
+		break;
+	  case NSREQ_SENDPAGES:
+		serve_sendpages(args->whom, (struct Nsreq_sendpages*)args->va, args->npages, 1);
+		break;
+	  case NSREQ_IOCTL:
+		serve_ioctl(args->whom, (struct Nsreq_ioctl*)args->va);
+		break;
+	  case NSREQ_SELECT:
+		serve_select(args->whom, (struct Nsreq_select*)args->va);
 		break;
 	  default:
 		cprintf("Invalid request code %d from %08x\n", args->whom, args->req);
 		break;
 	}
 
+	for (i = 0; i < args->npages; i++)
+		sys_page_unmap(0, (void*) args->va + i * PGSIZE);
 	put_buffer(args->va);
-	sys_page_unmap(0, (void*) args->va);
 	free(args);
 }
 
@@ -319,20 +435,37 @@ serve(void) {
 	uint32_t whom;
 	int perm;
 	void *va;
+	size_t npages;
 	
 	while (1) {
 		perm = 0;
 		va = get_buffer();
-		req = ipc_recv((int32_t *) &whom, (void *) va, &perm);
+		npages = SLOTPAGES;
+		// ipc_recv blocks the whole environment, so wake up in
+		// time for the first thread whose wait runs out, such as
+		// the lwIP timers
+		req = ipc_recv_timed((int32_t *) &whom, (void *) va, &npages, &perm,
+				     thread_wait_until());
 		if (debug) {
 			cprintf("ns req %d from %08x\n", req, whom);
 		}
 
 		// first take care of requests that do not contain an argument page
 		switch (req) {
-		  case NSREQ_TIMER:
-			process_timer(whom);
+		  case -E_TIMEOUT:
+			put_buffer(va);
+			thread_yield();
+			continue;
+		  case NSREQ_INPUT:
+			if (whom != 0)
+				break;
+			// the kernel says packets are waiting: have the
+			// input thread take them in, and let it and the
+			// threads they wake run
+			input_pending = 1;
+			thread_wakeup(&input_pending);
 			put_buffer(va);
+			thread_yield();
 			continue;
 		  default:
 			break;
@@ -353,8 +486,10 @@ serve(void) {
 		args->req = req;
 		args->whom = whom;
 		args->va = va;
+		args->npages = npages;
 
-		thread_create(0, "serve_thread", serve_thread, (uint32_t)args);
+		thread_create(0, "serve_thread", serve_thread, (uint32_t)args,
+			      THREAD_PRIO_NORMAL);
 		thread_yield(); // let the thread created run
 	}
 }
@@ -370,43 +505,18 @@ tmain(uint32_t arg) {
 void
 umain(void)
 {
-	envid_t ns_envid = sys_getenvid();
-
         binaryname = "ns";
 
-	// fork off the timer thread which will send us periodic messages
-	timer_envid = fork();
-	if (timer_envid < 0)
-		panic("error forking");
-	else if (timer_envid == 0) {
-		timer(ns_envid, TIMER_INTERVAL);
-		return;
-	}
-
-	// fork off the input thread which will poll the NIC driver for input
-	// packets
-	input_envid = fork();
-	if (input_envid < 0)
-		panic("error forking");
-	else if (input_envid == 0) {
-		input(ns_envid);
-		return;
-	}
-
-	// fork off the output thread that will send the packets to the NIC
-	// driver
-	output_envid = fork();
-	if (output_envid < 0)
-		panic("error forking");
-	else if (output_envid == 0) {
-		output(ns_envid);
-		return;
-	}
+	// ns needs no helper environments.  Packets go between the NIC
+	// driver and lwIP directly: jif posts receive buffers, is told
+	// through IPC from the kernel when they fill, and transmits with
+	// sys_net_txfrags.  lwIP's timers are threads, run when serve's
+	// timed receive runs out.
 
 	// lwIP requires a user threading library; start the library and jump
 	// into a thread to continue initialization. 
 	thread_init();
-	thread_create(0, "main", tmain, 0);
+	thread_create(0, "main", tmain, 0, THREAD_PRIO_NORMAL);
 	thread_yield();
 	// never coming here!
 }
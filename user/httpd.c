@@ -74,11 +74,19 @@ send_header(struct http_request *req, int code)
 }
 
 static int
-send_data(struct http_request *req, int fd)
+send_data(struct http_request *req, int fd, off_t size)
 {
 	char buf[256];
 	int n;
 
+	// files go to the network server straight from the file
+	// server's cache; anything else is copied through buf
+	if ((n = sendfile(req->sock, fd, 0, size)) != -E_INVAL) {
+		if (n != size)
+			die("Failed to sent file to client");
+		return 0;
+	}
+
 	for (;;) {
 		n = read(fd, buf, sizeof(buf));
 		if (n < 0) {
@@ -256,7 +264,7 @@ send_file(struct http_request *req)
 	if ((r = send_header_fin(req)) < 0)
 		goto end;
 
-	r = send_data(req, fd);
+	r = send_data(req, fd, file_size);
 
 end:
 	close(fd);
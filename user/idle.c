@@ -9,10 +9,9 @@ umain(void)
 	binaryname = "idle";
 
 	// Loop forever, simply trying to yield to a different environment.
-	// Instead of busy-waiting like this,
-	// a better way would be to use the processor's HLT instruction
-	// to cause the processor to stop executing until the next interrupt -
-	// doing so allows the processor to conserve power more effectively.
+	// While other environments wait for messages or interrupts, the
+	// kernel halts the processor instead of running us, so we only
+	// run once nothing else is left.
 	while (1) {
 		sys_yield();
 
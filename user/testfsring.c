@@ -0,0 +1,94 @@
+#include <inc/lib.h>
+
+// Write 'c' at the start of /newmotd through a shared mapping.
+// munmap hands the dirty page and the close to the file server
+// through the request ring.
+static void
+poke(char c)
+{
+	int f, r;
+	char *va;
+
+	if ((f = open("/newmotd", O_RDWR)) < 0)
+		panic("open /newmotd: %e", f);
+	if ((r = mmap(f, 0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, (void**) &va)) < 0)
+		panic("mmap /newmotd: %e", r);
+	close(f);
+	va[0] = c;
+	if ((r = munmap(va, PGSIZE)) < 0)
+		panic("munmap: %e", r);
+}
+
+// Write 'c' at the start of /newmotd through a shared mapping and
+// queue the dirty page on the ring ourselves, keeping the file open so
+// that no close flushes it.  Returns how many blocks the next sync
+// writes: at least the one we dirtied, if the request reached the
+// server.
+static int
+poke_sync(char c)
+{
+	int f, r, n;
+	char *va;
+	struct Fd *fd;
+
+	if ((r = sync()) < 0)
+		panic("sync: %e", r);
+	if ((f = open("/newmotd", O_RDWR)) < 0)
+		panic("open /newmotd: %e", f);
+	if ((r = fd_lookup(f, &fd)) < 0)
+		panic("fd_lookup: %e", r);
+	if ((r = mmap(f, 0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, (void**) &va)) < 0)
+		panic("mmap /newmotd: %e", r);
+	va[0] = c;
+	fsring_dirty(fd->fd_file.id, 0);
+	if ((r = fsring_enter()) < 0)
+		panic("fsring_enter: %e", r);
+	if ((n = sync()) < 0)
+		panic("sync: %e", n);
+	if ((r = munmap(va, PGSIZE)) < 0)
+		panic("munmap: %e", r);
+	close(f);
+	return n;
+}
+
+static char
+peek(void)
+{
+	int f, r;
+	char c;
+
+	if ((f = open("/newmotd", O_RDONLY)) < 0)
+		panic("open /newmotd: %e", f);
+	if ((r = readn(f, &c, 1)) != 1)
+		panic("readn /newmotd: %e", r);
+	close(f);
+	return c;
+}
+
+void
+umain(int argc, char **argv)
+{
+	int r;
+	char c;
+
+	c = peek();
+	r = poke_sync('!');
+	cprintf("fsring writes %s\n", r > 0 && peek() == '!' ? "right" : "wrong");
+
+	// a forked child must get its own ring
+	if ((r = fork()) < 0)
+		panic("fork: %e", r);
+	if (r == 0) {
+		poke('?');
+		exit();
+	}
+	wait(r);
+	cprintf("fsring after fork %s\n", peek() == '?' ? "is good" : "is broken");
+	poke(c);
+
+	// errors come back from fsring_enter
+	fsring_dirty(-1, 0);
+	fsring_dirty(-1, PGSIZE);
+	r = fsring_enter();
+	cprintf("fsring reports errors %s\n", r == -E_INVAL ? "right" : "wrong");
+}
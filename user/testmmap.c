@@ -0,0 +1,33 @@
+#include <inc/lib.h>
+
+char buf[PGSIZE];
+
+void
+umain(int argc, char **argv)
+{
+	int f, n, r;
+	char *va;
+
+	if ((f = open("/motd", O_RDONLY)) < 0)
+		panic("open /motd: %e", f);
+	if ((n = readn(f, buf, sizeof(buf))) < 0)
+		panic("readn /motd: %e", n);
+
+	if ((r = mmap(f, 0, n, PROT_READ|PROT_WRITE, MAP_PRIVATE, (void**) &va)) < 0)
+		panic("mmap /motd: %e", r);
+	close(f);
+	cprintf("mmap reads %s\n", memcmp(va, buf, n) == 0 ? "right" : "wrong");
+
+	// a private write must not reach the file
+	va[0] = '!';
+	if ((f = open("/motd", O_RDONLY)) < 0)
+		panic("open /motd: %e", f);
+	if ((r = readn(f, buf, 1)) != 1)
+		panic("readn /motd: %e", r);
+	close(f);
+	cprintf("MAP_PRIVATE handles writes %s\n", buf[0] != '!' ? "right" : "wrong");
+
+	if ((r = munmap(va, n)) < 0)
+		panic("munmap: %e", r);
+	cprintf("munmap is good\n");
+}
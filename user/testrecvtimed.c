@@ -0,0 +1,41 @@
+#include <inc/lib.h>
+
+// A timed receive gives up at its deadline, and a message sent before
+// the deadline is received as usual.
+void
+umain(int argc, char **argv)
+{
+	envid_t who, parent = sys_getenvid();
+	size_t npages;
+	unsigned int start, now;
+	int32_t r;
+
+	start = sys_time_msec();
+	npages = 0;
+	r = ipc_recv_timed(&who, 0, &npages, 0, start + 100);
+	now = sys_time_msec();
+	if (r != -E_TIMEOUT)
+		panic("ipc_recv_timed returned %e, not a timeout", r);
+	if (now < start + 100)
+		panic("ipc_recv_timed timed out after %u msec of 100", now - start);
+	cprintf("timed receive timed out after %u msec\n", now - start);
+
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0) {
+		ipc_send(parent, 42, 0, 0);
+		return;
+	}
+
+	npages = 0;
+	r = ipc_recv_timed(&who, 0, &npages, 0, sys_time_msec() + 5000);
+	if (r != 42)
+		panic("ipc_recv_timed returned %e, not the message", r);
+
+	// A deadline that has already passed times out at once.
+	npages = 0;
+	r = ipc_recv_timed(&who, 0, &npages, 0, 0);
+	if (r != -E_TIMEOUT)
+		panic("ipc_recv_timed with a past deadline returned %e", r);
+	cprintf("timed receive is good\n");
+}
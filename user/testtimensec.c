@@ -0,0 +1,47 @@
+#include <inc/lib.h>
+
+// The clock page at UTIME agrees with the kernel, never runs
+// backwards, and has better than tick resolution when there is a TSC.
+void
+umain(int argc, char **argv)
+{
+	uint64_t ns, prev, sys;
+	unsigned int msec, i, steps;
+	size_t npages;
+	int r;
+
+	if ((r = sys_time_nsec(&sys)) < 0)
+		panic("sys_time_nsec: %e", r);
+	ns = time_nsec();
+	if (ns < sys || ns - sys > 100000000)
+		panic("time_nsec is %u usec off sys_time_nsec",
+		      (uint32_t) ((ns - sys) / 1000));
+	msec = sys_time_msec();
+	if (time_msec() != msec && time_msec() != msec + 10)
+		panic("time_msec %u disagrees with sys_time_msec %u",
+		      time_msec(), msec);
+
+	prev = time_nsec();
+	steps = 0;
+	for (i = 0; i < 100000; i++) {
+		ns = time_nsec();
+		if (ns < prev)
+			panic("time_nsec went backwards");
+		if (ns != prev)
+			steps++;
+		prev = ns;
+	}
+	if (timeinfo.ti_tsc_mult && steps < 1000)
+		panic("time_nsec only changed %u times in 100000 reads", steps);
+
+	// A 100 msec timed receive lasts about 100 msec by the TSC too.
+	npages = 0;
+	prev = time_nsec();
+	ipc_recv_timed(0, 0, &npages, 0, time_msec() + 100);
+	ns = time_nsec() - prev;
+	if (ns < 80000000 || ns > 1000000000)
+		panic("a 100 msec timeout took %u usec", (uint32_t) (ns / 1000));
+
+	cprintf("TSC at %u kHz; time_nsec is good\n",
+		(uint32_t) (timeinfo.ti_tsc_hz / 1000));
+}